@@ -1,25 +1,436 @@
 #include "popl.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
 #include <cstdlib>
 #include <chrono>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "cubes.h"
+#include "seed_coordinator.h"
+#include "seed_journal.h"
+#include "seed_results.h"
+
+//Exit code when a search was stopped by --time-limit or a signal before finishing
+const int EXIT_STOPPED_EARLY = 2;
+
+//Pool a SIGINT / SIGTERM asks to stop
+static std::atomic<polycubes_thread_pool*> g_stoppable_pool{ nullptr };
+
+extern "C" void handle_stop_signal(int signal_number)
+{
+    polycubes_thread_pool* pool = g_stoppable_pool.load();
+    if (pool)
+    {
+        pool->request_stop();
+    }
+
+    //A second signal kills the process as usual, for when stopping cleanly takes too long
+    signal(signal_number, SIG_DFL);
+}
+
+/// <summary>
+/// Asks a pool to stop once a time limit has passed, unless cancelled first
+/// </summary>
+class stop_timer
+{
+public:
+
+    ~stop_timer()
+    {
+        cancel();
+    }
+
+    void start(polycubes_thread_pool& pool, int seconds)
+    {
+        if (seconds <= 0)
+        {
+            return;
+        }
+
+        m_thread = std::thread([this, &pool, seconds]() {
+            std::unique_lock<std::mutex> lock{ m_mutex };
+            if (!m_wake.wait_for(lock, std::chrono::seconds(seconds), [this]() { return m_cancelled; }))
+            {
+                printf("Time limit of %d s reached, stopping\n", seconds);
+                pool.request_stop();
+            }
+        });
+    }
+
+    void cancel()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_cancelled = true;
+        lock.unlock();
+
+        m_wake.notify_all();
+        m_thread.join();
+    }
+
+private:
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_cancelled = false;
+};
+
+/// <summary>
+/// Expands the seeds belonging to one shard (or all of them, for shard 0 of 1)
+/// Finished seeds are recorded in the journal if one is given, and seeds already in it are skipped when resuming
+/// Seeds part way through are also checkpointed to the journal every checkpoint_seconds, and picked up from there when resuming
+/// Per seed counts for the shard are written to results_path, if given
+/// If the search is stopped early, reports how far it got, and leaves the journal to resume from instead of writing results
+/// </summary>
+/// <returns>the process exit code</returns>
+int run_seed_search(polycubes_thread_pool& pool, int n, size_t shard_index, size_t shard_count, const std::string& results_path,
+    const std::string& journal_path, bool resume, int checkpoint_seconds)
+{
+    if (n <= pool.get_split_depth())
+    {
+        printf("Error! n must be larger than the split depth (%d) to shard or journal\n", pool.get_split_depth());
+        return -1;
+    }
+
+    stack_allocator allocator;
+    const std::vector<polycube_seed>& seeds = pool.get_seeds();
+    std::vector<size_t> shard_ids = select_shard_seeds(seeds.size(), shard_index, shard_count);
+    seed_results_header header{ n, pool.get_split_depth(), seeds.size(), hash_seeds(seeds), shard_index, shard_count };
+
+    seed_journal journal;
+    std::vector<size_t> seed_ids;
+    seed_search_hooks hooks;
+
+    if (!journal_path.empty())
+    {
+        if (!journal.open(journal_path, header, resume))
+        {
+            return -1;
+        }
+
+        for (size_t id : shard_ids)
+        {
+            if (!journal.is_done(id))
+            {
+                seed_ids.push_back(id);
+            }
+        }
+
+        size_t num_partial = 0;
+        for (size_t id : seed_ids)
+        {
+            num_partial += journal.resume_point(id) != nullptr;
+        }
+
+        if (journal.num_done() > 0 || num_partial > 0)
+        {
+            printf("Resuming from %s: %llu of %llu seeds already done, %llu part way through\n", journal_path.c_str(), (unsigned long long)journal.num_done(),
+                (unsigned long long)shard_ids.size(), (unsigned long long)num_partial);
+        }
+
+        hooks.on_seed_done = [&](size_t id, output_t count) { journal.record(id, count); };
+        hooks.on_seed_checkpoint = [&](size_t id, const seed_resume_point& point) { journal.record_partial(id, point); };
+        hooks.get_resume_point = [&](size_t id) { return journal.resume_point(id); };
+        hooks.checkpoint_seconds = checkpoint_seconds;
+    }
+    else
+    {
+        seed_ids = shard_ids;
+    }
+
+    std::vector<output_t> seed_counts;
+    std::vector<uint8_t> seed_done;
+    size_t total = pool.expand_seeds(allocator, n, seeds, seed_ids, &seed_counts, hooks, &seed_done);
+
+    if (pool.was_stopped())
+    {
+        journal.close();
+
+        size_t num_done = 0, num_partial = 0;
+        output_t partial_total = 0;
+        for (size_t id : shard_ids)
+        {
+            if (journal_path.empty() ? seed_done[id] != 0 : journal.is_done(id))
+            {
+                num_done++;
+            }
+            else if (!journal_path.empty() && journal.resume_point(id))
+            {
+                num_partial++;
+                partial_total += journal.resume_point(id)->partial_count;
+            }
+        }
+
+        output_t done_total = journal_path.empty() ? (output_t)total : journal.total();
+        printf("Stopped early for n = {%d}: %llu of %llu seeds finished, found {%llu} polycubes in them\n", n, (unsigned long long)num_done,
+            (unsigned long long)shard_ids.size(), (unsigned long long)done_total);
+
+        if (journal_path.empty())
+        {
+            printf("No journal was given, so this can't be resumed\n");
+        }
+        else
+        {
+            printf("%llu more seeds checkpointed part way through, with %llu polycubes found so far. Resume with -j %s --resume\n",
+                (unsigned long long)num_partial, (unsigned long long)partial_total, journal_path.c_str());
+        }
+        return EXIT_STOPPED_EARLY;
+    }
+
+    if (!journal_path.empty())
+    {
+        journal.close();
+        for (size_t id : shard_ids)
+        {
+            seed_counts[id] = journal.count(id);
+        }
+        total = journal.total();
+    }
+
+    if (!results_path.empty())
+    {
+        std::vector<seed_result> results;
+        for (size_t id : shard_ids)
+        {
+            results.push_back({ id, seed_counts[id] });
+        }
+
+        if (!write_seed_results(results_path, header, results))
+        {
+            return -1;
+        }
+    }
+
+    if (shard_count > 1)
+    {
+        printf("Shard %llu/%llu: %llu of %llu seeds, found %llu polycubes, written to %s\n", (unsigned long long)shard_index, (unsigned long long)shard_count,
+            (unsigned long long)shard_ids.size(), (unsigned long long)seeds.size(), (unsigned long long)total, results_path.c_str());
+    }
+    else
+    {
+        printf("For n = {%d}, found {%llu} polycubes\n", n, (unsigned long long)total);
+    }
+    return 0;
+}
+
+/// <summary>
+/// Sums a complete set of shard result files
+/// </summary>
+/// <returns>the process exit code</returns>
+int run_merge(const std::vector<std::string>& paths)
+{
+    seed_results_header header;
+    size_t total;
+    if (!merge_seed_results(paths, header, total))
+    {
+        return -1;
+    }
+
+    printf("Merged %llu files, all %llu seeds present\n", (unsigned long long)paths.size(), (unsigned long long)header.num_seeds);
+    printf("For n = {%d}, found {%llu} polycubes\n", header.n, (unsigned long long)total);
+    return 0;
+}
+
+/// <summary>
+/// Parses a size to search, either a single n or an inclusive range "low..high"
+/// </summary>
+/// <param name="text"></param>
+/// <param name="out_low"></param>
+/// <param name="out_high"></param>
+/// <returns></returns>
+bool parse_n_range(const std::string& text, int& out_low, int& out_high)
+{
+    char trailing;
+    if (sscanf(text.c_str(), "%d..%d%c", &out_low, &out_high, &trailing) == 2)
+    {
+    }
+    else if (sscanf(text.c_str(), "%d%c", &out_low, &trailing) == 1)
+    {
+        out_high = out_low;
+    }
+    else
+    {
+        printf("Error! n must be a number or a range low..high, got '%s'\n", text.c_str());
+        return false;
+    }
+
+    if (out_low < 1 || out_high < out_low)
+    {
+        printf("Error! n must be at least 1, and a range can't be empty, got '%s'\n", text.c_str());
+        return false;
+    }
+
+    return check_polycube_size(out_high);
+}
+
+/// <summary>
+/// Counts the polycubes of every size in [low, high] on one pool, printing each result as it completes
+/// The workers, their allocators and the seeds are shared by every size
+/// </summary>
+/// <returns>the process exit code</returns>
+int run_sweep(polycubes_thread_pool& pool, int low, int high)
+{
+    for (int n = low; n <= high && !pool.stop_requested(); n++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        generate_polycubes_threaded(n, pool);
+        auto stop = std::chrono::high_resolution_clock::now();
+
+        printf("Elapsed time for n = %d: %f s \n", n, (std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() / 1000.0f));
+        fflush(stdout);
+    }
+    return pool.stop_requested() ? EXIT_STOPPED_EARLY : 0;
+}
 
 int main(int argc, char** argv)
 {
     popl::OptionParser options("Options");
-    auto nOption = options.add<popl::Value<int>>("n", "N", "The number of cubes within each polycube");
+    auto nOption = options.add<popl::Value<std::string>>("n", "N", "The number of cubes within each polycube, or a range low..high to sweep on one pool");
     auto threadOption = options.add<popl::Value<int>>("t", "threads", "The number of worker threads to use");
+    auto splitOption = options.add<popl::Value<int>>("s", "split", "Size of the seed polycubes the search is split on, raise for large thread counts", DEFAULT_SPLIT_DEPTH);
+    auto dispatchOption = options.add<popl::Value<std::string>>("d", "dispatch", "How work is handed to workers: 'array' (seed array, default), 'queue' (job per seed) or 'forkjoin' (large subtrees stolen by idle workers)", "array");
+    auto orderOption = options.add<popl::Value<std::string>>("o", "order", "Order seeds are handed out in with array dispatch: 'cost' (longest estimated first, default) or 'dfs'", "cost");
+    auto shardOption = options.add<popl::Value<std::string>>("", "shard", "Only expand shard i of N (given as i/N) of the seeds, writing per seed counts to a result file");
+    auto resultsOption = options.add<popl::Value<std::string>>("", "results", "Result file written in shard or coordinator mode, defaults to polycubes_n<n>_shard<i>of<N>.txt / polycubes_n<n>_ledger.txt");
+    auto mergeOption = options.add<popl::Switch>("", "merge", "Sum the shard result files given as arguments, checking every seed is present exactly once");
+    auto coordinateOption = options.add<popl::Value<std::string>>("", "coordinate", "Run as a coordinator on this unix socket, handing seeds out to --worker processes");
+    auto workerOption = options.add<popl::Value<std::string>>("", "worker", "Run as a worker for the coordinator on this unix socket, using -t threads");
+    auto reassignOption = options.add<popl::Value<int>>("", "reassign-after", "Seconds before a coordinator backs up seeds held by a slow worker, 0 to never", 300);
+    auto journalOption = options.add<popl::Value<std::string>>("j", "journal", "Record each finished seed in this journal, synced to disk in batches");
+    auto resumeOption = options.add<popl::Switch>("", "resume", "Skip the seeds already recorded in the journal, after a crash or restart");
+    auto checkpointOption = options.add<popl::Value<int>>("", "checkpoint-interval", "With --journal, seconds between checkpoints of each thread's position within its current seed, 0 to never", 60);
+    auto affinityOption = options.add<popl::Value<std::string>>("", "affinity", "Pin workers to cpus: 'none' (default), 'compact' (fill a NUMA node at a time), 'scatter' (round robin across nodes) or a cpu list like 0-7,16-23", "none");
+    auto timeLimitOption = options.add<popl::Value<int>>("", "time-limit", "Stop after this many seconds, finishing or checkpointing the seeds in progress. SIGINT / SIGTERM stop the same way", 0);
+    auto spawnOption = options.add<popl::Value<int>>("", "spawn-remaining", "With fork join dispatch, subtrees are offered to idle workers while more than this many cubes remain to be added", DEFAULT_SPAWN_REMAINING);
+    auto progressOption = options.add<popl::Value<int>>("p", "progress", "Seconds between progress reports while searching, 0 to never", 10);
+    auto hugePagesOption = options.add<popl::Value<std::string>>("", "huge-pages", "Back each worker's stack and the seed array with 2 MB pages: 'off' (default), 'thp' (transparent) or 'explicit' (reserved pool, falling back to thp)", "off");
     options.parse(argc, argv);
 
+    if (mergeOption->is_set())
+    {
+        return run_merge(options.non_option_args());
+    }
+
+    affinity_policy affinity;
+    std::vector<int> affinity_cpus;
+    if (!parse_affinity(affinityOption->value(), affinity, affinity_cpus))
+    {
+        return -1;
+    }
+
+    //Set before any pool exists, as each worker chains its first stack chunk as it starts
+    huge_page_mode huge_pages;
+    if (!parse_huge_page_mode(hugePagesOption->value(), huge_pages))
+    {
+        return -1;
+    }
+    huge_page_setting().store(huge_pages);
+
+    if (workerOption->is_set())
+    {
+        polycubes_thread_pool pool;
+        pool.set_affinity(affinity, affinity_cpus);
+        pool.set_progress_interval(progressOption->value());
+        pool.init(threadOption->is_set() ? threadOption->value() : 1);
+
+        g_stoppable_pool = &pool;
+        signal(SIGINT, handle_stop_signal);
+        signal(SIGTERM, handle_stop_signal);
+        stop_timer timer;
+        timer.start(pool, timeLimitOption->value());
+
+        int result = run_socket_worker(workerOption->value(), pool);
+        timer.cancel();
+        g_stoppable_pool = nullptr;
+        pool.shutdown();
+        return result;
+    }
+
     if (!nOption->is_set())
     {
         printf("%s\n", options.help().c_str());
         return -1;
     }
 
-    int n = nOption->value();
+    int n, n_high;
+    if (!parse_n_range(nOption->value(), n, n_high))
+    {
+        return -1;
+    }
+
+    if (n_high != n && (coordinateOption->is_set() || shardOption->is_set() || journalOption->is_set()))
+    {
+        printf("Error! --coordinate, --shard and --journal search a single n, not a range\n");
+        return -1;
+    }
+
+    dispatch_mode mode;
+    if (dispatchOption->value() == "array")
+    {
+        mode = dispatch_mode::SeedArray;
+    }
+    else if (dispatchOption->value() == "queue")
+    {
+        mode = dispatch_mode::JobQueue;
+    }
+    else if (dispatchOption->value() == "forkjoin")
+    {
+        mode = dispatch_mode::ForkJoin;
+    }
+    else
+    {
+        printf("Unknown dispatch mode '%s'\n%s\n", dispatchOption->value().c_str(), options.help().c_str());
+        return -1;
+    }
+
+    seed_order order;
+    if (orderOption->value() == "cost")
+    {
+        order = seed_order::LongestFirst;
+    }
+    else if (orderOption->value() == "dfs")
+    {
+        order = seed_order::Generated;
+    }
+    else
+    {
+        printf("Unknown seed order '%s'\n%s\n", orderOption->value().c_str(), options.help().c_str());
+        return -1;
+    }
+
+    if (coordinateOption->is_set())
+    {
+        if (n <= splitOption->value() || splitOption->value() < 3 || splitOption->value() > MAX_SEED_SIZE)
+        {
+            printf("Error! split depth must be between 3 and %d, and less than n\n", MAX_SEED_SIZE);
+            return -1;
+        }
+
+        std::string path = resultsOption->is_set() ? resultsOption->value() : "polycubes_n" + std::to_string(n) + "_ledger.txt";
+        std::string journal_path = journalOption->is_set() ? journalOption->value() : path + ".journal";
+        return run_coordinator(coordinateOption->value(), n, splitOption->value(), reassignOption->value(), path, journal_path, resumeOption->is_set());
+    }
+
+    size_t shard_index = 0, shard_count = 0;
+    if (shardOption->is_set() && !parse_shard(shardOption->value(), shard_index, shard_count))
+    {
+        return -1;
+    }
+
+    if (resumeOption->is_set() && !journalOption->is_set())
+    {
+        printf("Error! --resume needs a --journal to resume from\n");
+        return -1;
+    }
+
     auto t1_start =  std::chrono::high_resolution_clock::now();
 
     size_t polycubes;
@@ -31,14 +442,85 @@ int main(int argc, char** argv)
     }
 
     polycubes_thread_pool pool;
+    if (!pool.set_split_depth(splitOption->value()))
+    {
+        return -1;
+    }
+    if (!pool.set_spawn_remaining(spawnOption->value()))
+    {
+        return -1;
+    }
+    pool.set_dispatch_mode(mode);
+    pool.set_seed_order(order);
+    pool.set_progress_interval(progressOption->value());
+    pool.set_affinity(affinity, affinity_cpus);
     pool.init(num_threads);
+
+    if (timeLimitOption->value() > 0 && !journalOption->is_set())
+    {
+        printf("Warning! --time-limit without --journal, a search that's stopped can't be resumed\n");
+    }
+
+    g_stoppable_pool = &pool;
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    stop_timer timer;
+    timer.start(pool, timeLimitOption->value());
+
+    if (shardOption->is_set() || journalOption->is_set())
+    {
+        std::string path;
+        if (resultsOption->is_set())
+        {
+            path = resultsOption->value();
+        }
+        else if (shardOption->is_set())
+        {
+            path = "polycubes_n" + std::to_string(n) + "_shard" + std::to_string(shard_index) + "of" + std::to_string(shard_count) + ".txt";
+        }
+
+        if (!shardOption->is_set())
+        {
+            shard_index = 0;
+            shard_count = 1;
+        }
+
+        int result = run_seed_search(pool, n, shard_index, shard_count, path, journalOption->is_set() ? journalOption->value() : "",
+            resumeOption->is_set(), checkpointOption->value());
+        timer.cancel();
+        g_stoppable_pool = nullptr;
+        pool.shutdown();
+
+        auto t1_stop = std::chrono::high_resolution_clock::now();
+        printf("Elapsed time: %f s \n", (std::chrono::duration_cast<std::chrono::milliseconds>(t1_stop - t1_start).count() / 1000.0f));
+        return result;
+    }
+
+    if (n_high != n)
+    {
+        int result = run_sweep(pool, n, n_high);
+        timer.cancel();
+        g_stoppable_pool = nullptr;
+        pool.shutdown();
+
+        auto t1_stop = std::chrono::high_resolution_clock::now();
+        printf("Elapsed time: %f s \n", (std::chrono::duration_cast<std::chrono::milliseconds>(t1_stop - t1_start).count() / 1000.0f));
+        return result;
+    }
+
     polycubes = generate_polycubes_threaded(n, pool);
+    timer.cancel();
+    g_stoppable_pool = nullptr;
+    bool stopped = pool.was_stopped();
     pool.shutdown();
 
     auto t1_stop = std::chrono::high_resolution_clock::now();
 
-    printf("Found %llu unique polycubes\n", polycubes);
+    if (!stopped)
+    {
+        printf("Found %llu unique polycubes\n", (unsigned long long)polycubes);
+    }
     printf("Elapsed time: %f s \n", (std::chrono::duration_cast<std::chrono::milliseconds>(t1_stop - t1_start).count() / 1000.0f));
 
-    return 0;
+    return stopped ? EXIT_STOPPED_EARLY : 0;
 }
\ No newline at end of file
@@ -1,19 +1,31 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <functional>
+#include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <unordered_set>
 
 
+#include "huge_pages.h"
+#include "job_pool.h"
 #include "polycube_sparse.h"
+#include "progress_reporter.h"
 #include "stack_allocator.h"
+#include "sync_primitives.h"
+#include "thread_affinity.h"
 #include "thread_safe_queue.h"
 
 //////////////////////////////////////////////////
@@ -27,20 +39,69 @@ const int MAX_DIMENSIONS = 20;
 //could be smaller - based on function optimization of ( 1 + x )* (1 + y )*( 1 + z) subject to x + y + z = MAX_DIMENSIONS with x,y,z > 0 -> max elements comes out to ~ (MAX_DIMENSIONS / 3 + 1)^3
 const int MAX_ENTRIES = MAX_DIMENSIONS * MAX_DIMENSIONS * MAX_DIMENSIONS;
 
-const int16_t FILLED_CUBE = 0x7FFF;
+/// <summary>
+/// The highest label a search for polycubes of size n can write. Labels are numbered from 1 at the root, 6 around
+/// the second cube, then at most 5 more around each cube after, up to the n-1'th - the n'th is never expanded
+/// </summary>
+/// <param name="n"></param>
+/// <returns></returns>
+constexpr int max_label_for(int n)
+{
+    return n < 2 ? 1 : 1 + 6 + 5 * (n - 2);
+}
+
+//Bounds every label a search up to MAX_POLYCUBE_CUBES can write
+const int MAX_LABEL = max_label_for((int)MAX_POLYCUBE_CUBES);
+
+/// <summary>
+/// A cell of the grid - 0 if empty, a label, or FILLED_CUBE. The smallest type that holds every label, which is a byte
+/// for every n up to MAX_POLYCUBE_CUBES, halving the frames and what pad_cube, crop_cube and for_each_cube move
+/// </summary>
+using grid_cell = std::conditional<(MAX_LABEL < 0xFF), uint8_t, uint16_t>::type;
+
+const grid_cell FILLED_CUBE = std::numeric_limits<grid_cell>::max();
+
+static_assert(max_label_for((int)MAX_POLYCUBE_CUBES) < (int)FILLED_CUBE, "a label of the largest n searched would read as a filled cube");
+static_assert(MAX_LABEL <= (int)std::numeric_limits<uint8_t>::max(), "filled_cubes.labels keeps each label in a byte");
+
+/// <summary>
+/// Checks n is small enough to search for. The cube stacks are MAX_POLYCUBE_CUBES long, and grid cells
+/// are only wide enough for the labels up to it
+/// </summary>
+/// <param name="n"></param>
+/// <returns></returns>
+inline bool check_polycube_size(int n)
+{
+    if (n > (int)MAX_POLYCUBE_CUBES)
+    {
+        printf("Error! n can be at most %d, got %d\n", (int)MAX_POLYCUBE_CUBES, n);
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// State push_cube overwrites, saved so pop_cube can put it back
+/// </summary>
+struct cube_undo
+{
+    position min_bounds;
+    position max_bounds;
+    int highest_numbering;
+};
 
 /// <summary>
 /// Rooted polycube, based on description given here: http://kevingong.com/Polyominoes/ParallelPoly.html
+/// Laid out hot to cold - the header the search touches on every cube pushed comes first, within a cache line,
+/// then the per cube stacks, of which each push touches one entry, and the grid last
 /// </summary>
 struct rooted_polycube
 {
     int k; //number of cubes
-    position root; //position of root
-    position dim; //dim of this cube
     int highest_numbering; //highest number cube filled in
     int highest_written; //highest value already used to mark
-
-    uint16_t cubes[MAX_ENTRIES]; //elements must be able to store MAX_ENTRIES
+    position root; //position of root
+    position dim; //dim of this cube
 
     position min_bounds; //Minimum values of written cubes
     position max_bounds; //maximum values of written cubes
@@ -50,10 +111,17 @@ struct rooted_polycube
 
     struct
     {
-        position stack[32]; //Filled Cubes Relative to root
         size_t current;
+        position stack[32]; //Filled Cubes Relative to root
+        uint8_t labels[32]; //Label each filled cube had when it was chosen, in the same order as stack
     } filled_cubes;
 
+    //What each push_cube overwrote, by position in filled_cubes. Only entries for cubes pushed onto this frame are valid,
+    //frames made by prepare_children start with none, as the cubes already there are never popped from them
+    cube_undo undo_log[32];
+
+    grid_cell cubes[MAX_ENTRIES];
+
 #ifdef _DEBUG
     std::vector<int> debug_push_order;
 #endif
@@ -63,23 +131,23 @@ struct rooted_polycube
         return (size_t)dim.x * dim.y * dim.z;
     }
 
-    int16_t get_cube(int x, int y, int z) const
+    int get_cube(int x, int y, int z) const
     {
         int index = z * (dim.y * (int) dim.x) + y * dim.x + x;
         return cubes[index];
     }
 
-    void set_cube(int x, int y, int z, int16_t elem)
+    void set_cube(int x, int y, int z, int elem)
     {
         int index = z * (dim.y * (int)dim.x) + y * dim.x + x;
-        cubes[index] = elem;
+        cubes[index] = (grid_cell)elem;
     }
     void set_cube_if_zero_and_increment(int x, int y, int z,  int& inout_next_highest)
     {
         int index = z * (dim.y * (int) dim.x) + y * dim.x + x;
         if (cubes[index] == 0)
         {
-            cubes[index] = inout_next_highest;
+            cubes[index] = (grid_cell)inout_next_highest;
             inout_next_highest++;
         }
     }
@@ -89,7 +157,7 @@ struct rooted_polycube
         int index = z * (dim.y * (int)dim.x) + y * dim.x + x;
         if (cubes[index] == 0)
         {
-            cubes[index] = inout_next_highest;
+            cubes[index] = (grid_cell)inout_next_highest;
             inout_next_highest++;
 
             position current = { (int8_t) x, (int8_t)y, (int8_t)z };
@@ -137,9 +205,9 @@ struct rooted_polycube
 
 };
 
-//Assuming a max of 2 per stack frame, 32 depth
-using stack_allocator = stack_allocator_typed<rooted_polycube, 64>;
-using stack_marker = stack_marker_typed<rooted_polycube, 64>;
+//At most 2 per level of the dfs, so one chunk covers the usual searches, and deeper ones chain more on demand
+using stack_allocator = stack_allocator_typed<rooted_polycube, 32>;
+using stack_marker = stack_marker_typed<rooted_polycube, 32>;
 
 /// <summary>
 /// pads a polycube with zeros to allow for expanding. Assumes expansion won't violate rooted property
@@ -303,7 +371,7 @@ inline void crop_cube(const rooted_polycube& base, rooted_polycube& out_cropped)
 
     memset(out_cropped.cubes, 0, out_cropped.size() * sizeof(out_cropped.cubes[0]));
 
-    base.for_each_cube([&](int x, int y, int z, int16_t cube)
+    base.for_each_cube([&](int x, int y, int z, int cube)
     {
         if (cube)
         {
@@ -318,25 +386,24 @@ inline void crop_cube(const rooted_polycube& base, rooted_polycube& out_cropped)
 }
 
 /// <summary>
-/// Converts rooted_polycube to sparse polycube
+/// Converts rooted_polycube to sparse polycube, which must have room for all its cubes
 /// </summary>
 /// <param name="current"></param>
-/// <returns></returns>
-polycube_sparse get_polycube_sparse_from_rooted(const rooted_polycube& current)
+/// <param name="out_pc"></param>
+template<size_t Capacity>
+void get_polycube_sparse_from_rooted(const rooted_polycube& current, polycube_sparse_n<Capacity>& out_pc)
 {
-    polycube_sparse pc;
-    pc.num_cubes = current.filled_cubes.current;
-    pc.dim = {  current.max_bounds.x - current.min_bounds.x + 1,
-                current.max_bounds.y - current.min_bounds.y + 1,
-                current.max_bounds.z - current.min_bounds.z + 1 };
+    out_pc.num_cubes = (uint8_t)current.filled_cubes.current;
+    out_pc.dim = {  (int8_t)(current.max_bounds.x - current.min_bounds.x + 1),
+                    (int8_t)(current.max_bounds.y - current.min_bounds.y + 1),
+                    (int8_t)(current.max_bounds.z - current.min_bounds.z + 1) };
 
     const position& min = current.min_bounds;
-    position offset = { - min.x, - min.y, - min.z };
+    position offset = { (int8_t)-min.x, (int8_t)-min.y, (int8_t)-min.z };
     current.for_each_filled([&](int x, int y, int z, size_t i)
     {
-        pc.cubes[i] = position{ (int8_t)x, (int8_t)y, (int8_t)z } + offset;
+        out_pc.cubes[i] = pack_position(position{ (int8_t)x, (int8_t)y, (int8_t)z } + offset);
     });
-    return pc;
 }
 
 /// <summary>
@@ -346,9 +413,10 @@ polycube_sparse get_polycube_sparse_from_rooted(const rooted_polycube& current)
 /// <param name="n"></param>
 /// <param name="out_pc"></param>
 /// <returns></returns>
-bool is_canonical_sparse(const rooted_polycube& current, int n, polycube_sparse& out_pc)
+template<size_t Capacity>
+bool is_canonical_sparse(const rooted_polycube& current, int n, polycube_sparse_n<Capacity>& out_pc)
 {
-    out_pc = get_polycube_sparse_from_rooted(current);
+    get_polycube_sparse_from_rooted(current, out_pc);
     return is_polycube_canonical_sparse(out_pc, n);
 }
 
@@ -395,10 +463,42 @@ std::ostream& operator<< (std::ostream& out, const std::vector<int>& v)
     return out << "\n";
 }
 
-template<typename OnFoundFunc, typename OnExpandedFunc>
-size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int m, rooted_polycube& current,  OnFoundFunc&& on_found, OnExpandedFunc&& on_expanded)
+/// <summary>
+/// Sets pc to the single root cube every search starts from
+/// </summary>
+/// <param name="pc"></param>
+inline void init_single_cube(rooted_polycube& pc)
+{
+    pc.k = 1;
+    pc.root = { 0,0,0 };
+    pc.dim = { 1, 1, 1 };
+    pc.cubes[0] = FILLED_CUBE;
+    pc.highest_numbering = 1;
+    pc.highest_written = 1;
+    pc.min_bounds = { 0, 0, 0 };
+    pc.max_bounds = { 0, 0, 0 };
+    pc.labeled_min_bounds = { 0, 0, 0 };
+    pc.labeled_max_bounds = { 0, 0, 0 };
+
+    pc.filled_cubes.stack[0] = { 0,0,0 };
+    pc.filled_cubes.labels[0] = 1;
+    pc.filled_cubes.current = 1;
+
+#ifdef _DEBUG
+    pc.debug_push_order.clear();
+    pc.debug_push_order.push_back(1);
+#endif
+}
+
+/// <summary>
+/// Labels the empty slots around the most recently added cube of current, in a frame allocated from allocator
+/// Returns the frame the children of current are chosen from
+/// </summary>
+/// <param name="allocator"></param>
+/// <param name="current"></param>
+/// <returns></returns>
+inline rooted_polycube* prepare_children(stack_allocator& allocator, const rooted_polycube& current)
 {
-    stack_marker marker(allocator);
     rooted_polycube* expanded = allocator.allocate();
 
     expand_empty_slots(current, *expanded);
@@ -415,10 +515,164 @@ size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int
         cropped = expanded;
     }
 
-    int highest_number = cropped->highest_numbering;
+    return cropped;
+}
+
+/// <summary>
+/// Fills the labelled cube at x, y, z, updating the bounds and filled cube stack
+/// What it overwrites goes on the undo log, so pop_cube can undo it
+/// </summary>
+inline void push_cube(rooted_polycube& pc, int x, int y, int z, int label)
+{
+    pc.undo_log[pc.filled_cubes.current] = cube_undo{ pc.min_bounds, pc.max_bounds, pc.highest_numbering };
+
+    pc.k++;
+    pc.set_cube(x, y, z, FILLED_CUBE);
+    pc.highest_numbering = label;
+
+    position current = { (int8_t)x, (int8_t)y,(int8_t)z };
+    position_min(pc.min_bounds, current);
+    position_max(pc.max_bounds, current);
+
+    pc.filled_cubes.stack[pc.filled_cubes.current] = { (int8_t)x - pc.root.x, (int8_t)y - pc.root.y, (int8_t)z - pc.root.z };
+    pc.filled_cubes.labels[pc.filled_cubes.current] = (uint8_t)label;
+    pc.filled_cubes.current++;
+
+#ifdef _DEBUG
+    pc.debug_push_order.push_back(label);
+#endif
+}
+
+/// <summary>
+/// Undoes the last push_cube onto this frame, restoring the cube's label from the filled cube stack, and the rest from the undo log
+/// </summary>
+/// <param name="pc"></param>
+inline void pop_cube(rooted_polycube& pc)
+{
+    size_t top = --pc.filled_cubes.current;
+    const cube_undo& undo = pc.undo_log[top];
+
+    position cube = pc.filled_cubes.stack[top] + pc.root;
+    pc.set_cube(cube.x, cube.y, cube.z, pc.filled_cubes.labels[top]);
+
+    pc.min_bounds = undo.min_bounds;
+    pc.max_bounds = undo.max_bounds;
+    pc.highest_numbering = undo.highest_numbering;
+    pc.k--;
+
+#ifdef _DEBUG
+    pc.debug_push_order.pop_back();
+#endif
+}
+
+/// <summary>
+/// A polycube the search counted, as a view into the frame that reached it - its filled cubes relative to the root,
+/// and the offset that moves them to the origin. Only valid during the on_found call it's passed to
+/// Nothing is copied until a callback asks for a sparse polycube, so callbacks that ignore leaves cost nothing
+/// </summary>
+struct leaf_view
+{
+    const position* cubes; //Relative to the root, in the order they were filled
+    size_t num_cubes;
+    position offset; //Added to a cube to move the polycube's min bounds to the origin
+    position dim;
+
+    inline position cube(size_t i) const
+    {
+        return cubes[i] + offset;
+    }
+
+    /// <summary>
+    /// Copies the leaf out as a sparse polycube, which must have room for all its cubes
+    /// </summary>
+    /// <param name="out_pc"></param>
+    template<size_t Capacity>
+    inline void materialize(polycube_sparse_n<Capacity>& out_pc) const
+    {
+        out_pc.num_cubes = (uint8_t)num_cubes;
+        out_pc.dim = pack_position(dim);
+        for (size_t i = 0; i < num_cubes; i++)
+        {
+            out_pc.cubes[i] = pack_position(cube(i));
+        }
+    }
+};
+
+inline leaf_view make_leaf_view(const rooted_polycube& pc)
+{
+    return leaf_view{ pc.filled_cubes.stack, pc.filled_cubes.current,
+        position{ (int8_t)(pc.root.x - pc.min_bounds.x), (int8_t)(pc.root.y - pc.min_bounds.y), (int8_t)(pc.root.z - pc.min_bounds.z) },
+        position{ (int8_t)(pc.max_bounds.x - pc.min_bounds.x + 1), (int8_t)(pc.max_bounds.y - pc.min_bounds.y + 1), (int8_t)(pc.max_bounds.z - pc.min_bounds.z + 1) } };
+}
+
+/// <summary>
+/// Checks whether a polycube of size n, reached by the search, is one to count - its bounds are in canonical order,
+/// and it's the canonical rooting of its shape
+/// The rotations are compared as sparse polycubes sized to n, so for small n each one copied is under a cache line
+/// </summary>
+/// <param name="pc"></param>
+/// <param name="n"></param>
+/// <returns></returns>
+inline bool is_counted_leaf(const rooted_polycube& pc, int n)
+{
+    position bounds = { pc.max_bounds.x - pc.min_bounds.x + 1,
+        pc.max_bounds.y - pc.min_bounds.y + 1,
+        pc.max_bounds.z - pc.min_bounds.z + 1 };
+
+    //Canonical form assumes width >= height >= depth, so ignore cases where that isn't
+    if (bounds.z > bounds.x && bounds.z > bounds.y)
+    {
+        //Depth is largest, ignore
+        return false;
+    }
+    else if (bounds.y > bounds.x && bounds.y > bounds.z)
+    {
+        //Height is largest, ignore
+        return false;
+    }
+    else if (bounds.z > bounds.y)
+    {
+        //Depth exceeds height
+        return false;
+    }
+
+    if (n <= (int)SMALL_POLYCUBE_CUBES)
+    {
+        polycube_sparse_small sparse;
+        return is_canonical_sparse(pc, n, sparse);
+    }
+
+    polycube_sparse sparse;
+    return is_canonical_sparse(pc, n, sparse);
+}
+
+/// <summary>
+/// Checks a polycube of size n reached by the search, and passes a view of it to on_found if it's one to count
+/// OnFoundFunc is const leaf_view& -> ()
+/// </summary>
+/// <param name="pc"></param>
+/// <param name="n"></param>
+/// <param name="on_found"></param>
+/// <returns>true if counted</returns>
+template<typename OnFoundFunc>
+inline bool count_leaf(const rooted_polycube& pc, int n, OnFoundFunc&& on_found)
+{
+    if (!is_counted_leaf(pc, n))
+    {
+        return false;
+    }
+
+    on_found(make_leaf_view(pc));
+    return true;
+}
+
+template<typename OnFoundFunc, typename OnExpandedFunc>
+size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int m, rooted_polycube& current,  OnFoundFunc&& on_found, OnExpandedFunc&& on_expanded)
+{
+    stack_marker marker(allocator);
+    rooted_polycube* cropped = prepare_children(allocator, current);
+
     size_t count = 0;
-    position current_min = cropped->min_bounds;
-    position current_max = cropped->max_bounds;
 
     if (!current.check_root())
     {
@@ -443,57 +697,13 @@ size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int
                 return;
             }
 
-            cropped->k++;
-            cropped->set_cube(x, y, z, FILLED_CUBE);
-            cropped->highest_numbering = cube;
-
-            position current = { (int8_t)x, (int8_t)y,(int8_t)z };
-            position_min(cropped->min_bounds, current);
-            position_max(cropped->max_bounds, current);
-
-            cropped->filled_cubes.stack[cropped->filled_cubes.current] = { (int8_t)x - cropped->root.x, (int8_t)y - cropped->root.y, (int8_t)z - cropped->root.z };
-            cropped->filled_cubes.current++;
-
-#ifdef _DEBUG
-            cropped->debug_push_order.push_back(cube);
-#endif
+            push_cube(*cropped, x, y, z, cube);
 
             if (cropped->k == n)
             {
-                position bounds = { cropped->max_bounds.x - cropped->min_bounds.x + 1,
-                    cropped->max_bounds.y - cropped->min_bounds.y + 1,
-                    cropped->max_bounds.z - cropped->min_bounds.z + 1 };
-
-                //Canonical form assumes width >= height >= depth, so ignore cases where that isn't
-                bool consider_this = true;
-                if (bounds.z > bounds.x && bounds.z > bounds.y)
-                {
-                    //Depth is largest, ignore
-                    consider_this = false;
-                }
-                else if (bounds.y > bounds.x && bounds.y > bounds.z)
-                {
-                    //Height is largest, ignore
-                    consider_this = false;
-                }
-                else if (bounds.z > bounds.y)
-                {
-                    //Depth exceeds height
-                    consider_this = false;
-                } 
-
-                if (consider_this)
+                if (count_leaf(*cropped, n, on_found))
                 {
-
-                    polycube_sparse pc;
-                    bool canonical = is_canonical_sparse(*cropped, n, pc);
-
-                    if (canonical)
-                    {
-                        count++;
-
-                        on_found(pc);
-                    }
+                    count++;
                 }
             }
             else if (cropped->k == m)
@@ -505,17 +715,7 @@ size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int
                 count += expand_polycubes_dfs_from_current(allocator, n, m, *cropped, on_found, on_expanded);
             }
 
-#ifdef _DEBUG
-            cropped->debug_push_order.pop_back();
-#endif
-
-            cropped->filled_cubes.current--;
-
-            cropped->min_bounds = current_min;
-            cropped->max_bounds = current_max;
-            cropped->highest_numbering = highest_number;
-            cropped->set_cube(x, y, z, cube);
-            cropped->k--;
+            pop_cube(*cropped);
         }
     });
 
@@ -524,14 +724,14 @@ size_t expand_polycubes_dfs_from_current(stack_allocator& allocator, int n, int
 
 /// <summary>
 /// Expand polycubes using dfs
-/// OnFoundFunc is const polycube_t& -> ()
+/// OnFoundFunc is const leaf_view& -> ()
 /// OnExpandedFunc is const rooted_polycube& -> ()
 /// m - size limit, if < n, calls on expanded instead of continuing search
 /// </summary>
 template<typename OnFoundFunc, typename OnExpandedFunc>
 size_t expand_polycubes_dfs(stack_allocator& allocator, int n, int m, OnFoundFunc&& on_found, OnExpandedFunc&& on_expanded)
 {
-    if (n < 1)
+    if (n < 1 || !check_polycube_size(n))
     {
         return 0;
     }
@@ -543,172 +743,1175 @@ size_t expand_polycubes_dfs(stack_allocator& allocator, int n, int m, OnFoundFun
     stack_marker marker(allocator);
     //proxy<rooted_polycube> next = allocator.allocate<rooted_polycube>();
     rooted_polycube* next = allocator.allocate();
-    next->k = 1;
-    next->root = { 0,0,0 };
-    next->dim = { 1, 1, 1 };
-    next->cubes[0] = FILLED_CUBE;
-    next->highest_numbering = 1;
-    next->highest_written = 1;
-    next->min_bounds = { 0, 0, 0 };
-    next->max_bounds = { 0, 0, 0 };
-    next->labeled_min_bounds = { 0, 0, 0 };
-    next->labeled_max_bounds = { 0, 0, 0 };
-
-    next->filled_cubes.stack[0] = { 0,0,0 };
-    next->filled_cubes.current = 1;
-
-#ifdef _DEBUG
-    next->debug_push_order.push_back(1);
-#endif
+    init_single_cube(*next);
 
     return expand_polycubes_dfs_from_current(allocator, n, m, *next,  on_found, on_expanded);
 }
 
 
-enum class job_type
-{
-    ExpandPolyCubes,
-    EndProcess
-};
+//////////////////////////////////////////////////
+// Seeds - the polycubes the search is split on
+//////////////////////////////////////////////////
 
-struct queue_job
-{
-    job_type type = job_type::EndProcess;
-    std::shared_ptr<void> data;
-};
+//Labels grow by at most 5 per added cube, so every label in a seed this size fits in a byte
+const int MAX_SEED_SIZE = 16;
 
-struct expand_poly_cubes_job
+/// <summary>
+/// Compact encoding of a rooted polycube the search is split on
+/// Stores the label chosen at each step from the single root cube, which is enough to rebuild the rooted polycube exactly
+/// </summary>
+struct polycube_seed
 {
-    rooted_polycube base;
-    int n;
+    uint8_t k; //number of cubes
+    uint8_t labels[MAX_SEED_SIZE - 1]; //label of each cube after the root, in the order they were added
 };
 
-struct worker_thread_context
+/// <summary>
+/// Encodes a rooted polycube found during the search as a seed
+/// </summary>
+/// <param name="pc"></param>
+/// <returns></returns>
+inline polycube_seed make_seed(const rooted_polycube& pc)
 {
-    thread_safe_queue<queue_job>* job_queue;
-    thread_safe_queue<output_t>* output_queue;
-    size_t stack_size;
-};
+    polycube_seed seed = {}; //Unused labels are zeroed, so seeds compare and hash by their bytes
+    seed.k = (uint8_t)pc.k;
+    for (int i = 1; i < pc.k; i++)
+    {
+        seed.labels[i - 1] = pc.filled_cubes.labels[i];
+    }
+    return seed;
+}
 
 /// <summary>
-/// Worker thread function for polycube expander
+/// Rebuilds the rooted polycube a seed was made from, by replaying its labels from the single root cube
+/// Frames are taken from allocator, so the result is valid until the caller's marker is released
+/// Seeds are only ever made in process, by make_seed, so one that doesn't describe a valid search path is a bug, and aborts
 /// </summary>
-/// <param name="ctx"></param>
-/// <param name="id"></param>
-void polycubes_worker_thread(worker_thread_context ctx, int id)
+/// <param name="allocator"></param>
+/// <param name="seed"></param>
+/// <returns></returns>
+inline rooted_polycube* build_rooted_from_seed(stack_allocator& allocator, const polycube_seed& seed)
 {
-    stack_allocator allocator;
+    rooted_polycube* current = allocator.allocate();
+    init_single_cube(*current);
 
-    //printf("Starting Thread %d\n", id);
-    bool running = true;
-    while (running)
+    for (int i = 0; i + 1 < seed.k; i++)
     {
-        queue_job job;
-        if (ctx.job_queue->dequeue(job))
+        rooted_polycube* next = prepare_children(allocator, *current);
+        int label = seed.labels[i];
+
+        bool found = false;
+        next->for_each_cube([&](int x, int y, int z, int cube)
         {
-            switch (job.type)
+            if (!found && cube == label && cube > next->highest_numbering)
             {
-            case job_type::ExpandPolyCubes:
-                scope {
-                    expand_poly_cubes_job * expand_job = (expand_poly_cubes_job*)job.data.get();
-
-                    printf("Expanding on thread %d\n", id);
-
-                    size_t output = expand_polycubes_dfs_from_current(allocator, expand_job->n, expand_job->n, expand_job->base, [](auto&&) {}, [](auto&&) {});
-
-                    ctx.output_queue->enqueue(output);
-                }
-                break;
-            case job_type::EndProcess:
-                running = false;
-                break;
+                push_cube(*next, x, y, z, label);
+                found = true;
             }
-        }
-        else
+        });
+
+        if (!found)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            printf("Error! seed label %d not found at depth %d\n", label, i + 2);
+            fflush(stdout);
+            std::abort();
         }
+
+        current = next;
     }
+
+    return current;
 }
 
 /// <summary>
-/// Thread pool for managin parallel execution of polycube expanders
+/// Finds every rooted polycube of size m, in dfs order, encoded as seeds
+/// The seeds don't depend on the final size searched for, so can be shared between searches
 /// </summary>
-class polycubes_thread_pool
+/// <param name="allocator"></param>
+/// <param name="m"></param>
+/// <returns></returns>
+inline std::vector<polycube_seed> generate_seeds(stack_allocator& allocator, int m)
 {
+    std::vector<polycube_seed> seeds;
 
-public:
-    /// <summary>
-    /// Initialized the threads in the pool
-    /// </summary>
-    /// <param name="k"></param>
-    void init(size_t k)
-    {
-        if (k < 1)
-        {
-            printf("Error! no worker threads\n");
-            return;
-        }
+    //n is only ever reached past m, so it never finds anything
+    expand_polycubes_dfs(allocator, m + 1, m, [](auto&&) {}, [&](const rooted_polycube& pc) {
+        seeds.push_back(make_seed(pc));
+    });
 
-        for (int i = 0; i < k; i++)
-        {
-            worker_thread_context context{ &m_job_queue, &m_output_queue, (size_t)-1 };
-            m_worker_threads.push_back(std::thread(polycubes_worker_thread, context, i));
-        }
-    }
+    return seeds;
+}
 
-    /// <summary>
-    /// Computes the number of polycubes of size n using parrallel threads
-    /// </summary>
-    /// <param name="base_cubes"></param>
-    /// <param name="n"></param>
-    /// <returns></returns>
-    size_t generate_polycubes_parallel(int n)
-    {
-        stack_allocator allocator;
+/// <summary>
+/// Finds every seed of size m descended from a smaller seed, in dfs order, appending them to out_seeds
+/// Concatenating the results for every seed of one size, in order, gives the same seeds as generate_seeds
+/// </summary>
+/// <param name="allocator"></param>
+/// <param name="prefix"></param>
+/// <param name="m"></param>
+/// <param name="out_seeds"></param>
+inline void generate_seeds_from(stack_allocator& allocator, const polycube_seed& prefix, int m, std::vector<polycube_seed>& out_seeds)
+{
+    stack_marker marker(allocator);
+    rooted_polycube* base = build_rooted_from_seed(allocator, prefix);
 
-        int nodes_to_expand = 0;
+    expand_polycubes_dfs_from_current(allocator, m + 1, m, *base, [](auto&&) {}, [&](const rooted_polycube& pc) {
+        out_seeds.push_back(make_seed(pc));
+    });
+}
 
-        int EXPAND_SIZE_LIMIT = 5;
-        if (n <= EXPAND_SIZE_LIMIT)
-        {
-            //Not big enough to care, expand single threaded
-            return expand_polycubes_dfs(allocator, n, n, [](auto&&) {}, [](auto&&) {});
-        }
+//How many cubes past the seed the cost probe searches
+const int SEED_PROBE_DEPTH = 2;
 
-        expand_polycubes_dfs(allocator, n, EXPAND_SIZE_LIMIT, [](auto&&) {}, [&](const rooted_polycube& pc) {
-            nodes_to_expand++;
+/// <summary>
+/// The size the cost probe of a seed of size k searches to, for a search up to size n
+/// Estimates only depend on n through this, so are the same for every n past k + SEED_PROBE_DEPTH
+/// </summary>
+/// <param name="k"></param>
+/// <param name="n"></param>
+/// <returns></returns>
+inline int seed_probe_size(int k, int n)
+{
+    //Never probe all the way to n, that would just be doing the search
+    return std::min(k + SEED_PROBE_DEPTH, n - 1);
+}
 
-            std::shared_ptr<expand_poly_cubes_job> expand_job = std::make_shared<expand_poly_cubes_job>();
-            expand_job->base = pc;
-            expand_job->n = n;
+/// <summary>
+/// Estimates how expensive it is to search from a seed up to size n, by counting its descendants SEED_PROBE_DEPTH cubes deeper
+/// Only the relative order of estimates matters
+/// </summary>
+/// <param name="allocator"></param>
+/// <param name="seed"></param>
+/// <param name="n"></param>
+/// <returns></returns>
+inline uint64_t estimate_seed_cost(stack_allocator& allocator, const polycube_seed& seed, int n)
+{
+    int probe_size = seed_probe_size(seed.k, n);
+    if (probe_size <= seed.k)
+    {
+        return 1;
+    }
 
-            m_job_queue.enqueue(queue_job{ job_type::ExpandPolyCubes, expand_job });
-        });
-         
-        //Do persistence to file and counting -> wait for m results from threads
-        size_t num_polycubes = 0;
+    stack_marker marker(allocator);
+    rooted_polycube* base = build_rooted_from_seed(allocator, seed);
 
-        for (int i = 0; i < nodes_to_expand; i++)
-        {
-            size_t result = m_output_queue.blocking_dequeue();
+    uint64_t descendants = 0;
+    expand_polycubes_dfs_from_current(allocator, n, probe_size, *base, [](auto&&) {}, [&](auto&&) { descendants++; });
 
-            num_polycubes += result;
+    return std::max(descendants, (uint64_t)1);
+}
+
+//Checkpointed searches split a seed into subtrees rooted this many cubes short of n, and can checkpoint between any two of them
+const int CHECKPOINT_SUBTREE_DEPTH = 6;
+
+/// <summary>
+/// A position part way through a seed's search, to pick it back up from
+/// </summary>
+struct seed_resume_point
+{
+    output_t partial_count; //polycubes found in the subtrees before the frontier polycube
+    std::vector<uint8_t> labels; //labels of the frontier polycube's cubes after the root, the next subtree to search
+};
+
+/// <summary>
+/// Checks whether a rooted polycube is the frontier polycube of a resume point
+/// </summary>
+/// <param name="pc"></param>
+/// <param name="resume"></param>
+/// <returns></returns>
+inline bool is_resume_frontier(const rooted_polycube& pc, const seed_resume_point& resume)
+{
+    if ((size_t)pc.k != resume.labels.size() + 1)
+    {
+        return false;
+    }
+    return memcmp(&pc.filled_cubes.labels[1], resume.labels.data(), resume.labels.size()) == 0;
+}
+
+/// <summary>
+/// Counts polycubes of size n from base like expand_polycubes_dfs_from_current, but as a sequence of subtrees rooted at the
+/// frontier polycubes CHECKPOINT_SUBTREE_DEPTH cubes short of n. Before each subtree, on_checkpoint(partial_count, frontier) is called,
+/// and can save a resume point from them. If it returns false the search stops there, and out_stopped is set
+/// If resume is given, subtrees before its frontier are skipped, and counting starts from its partial count
+/// OnCheckpointFunc is (output_t, const rooted_polycube&) -> bool
+/// </summary>
+template<typename OnCheckpointFunc>
+output_t expand_polycubes_checkpointed(stack_allocator& allocator, int n, rooted_polycube& base, const seed_resume_point* resume, OnCheckpointFunc&& on_checkpoint,
+    bool* out_stopped = nullptr)
+{
+    if (out_stopped)
+    {
+        *out_stopped = false;
+    }
+
+    int frontier_size = n - CHECKPOINT_SUBTREE_DEPTH;
+    if (frontier_size <= base.k)
+    {
+        //Too close to n to be worth splitting up
+        return expand_polycubes_dfs_from_current(allocator, n, n, base, [](auto&&) {}, [](auto&&) {});
+    }
+
+    output_t count = resume ? resume->partial_count : 0;
+    bool skipping = resume != nullptr;
+    bool stopped = false;
+
+    //Enumerating the frontier again up to the resume point is cheap, it's the subtrees below it that are expensive
+    expand_polycubes_dfs_from_current(allocator, n, frontier_size, base, [](auto&&) {}, [&](rooted_polycube& frontier) {
+        //The frontier dfs can't be broken out of, but once stopped the rest of it is cheap
+        if (stopped)
+        {
+            return;
         }
 
-        return num_polycubes;
+        if (skipping)
+        {
+            if (!is_resume_frontier(frontier, *resume))
+            {
+                return;
+            }
+            skipping = false;
+        }
+
+        if (!on_checkpoint(count, (const rooted_polycube&)frontier))
+        {
+            stopped = true;
+            return;
+        }
+        count += expand_polycubes_dfs_from_current(allocator, n, n, frontier, [](auto&&) {}, [](auto&&) {});
+    });
+
+    if (stopped)
+    {
+        if (out_stopped)
+        {
+            *out_stopped = true;
+        }
+        return count;
     }
 
+    if (skipping)
+    {
+        printf("Error! resume point not found in seed, searching it from the start\n");
+        return expand_polycubes_dfs_from_current(allocator, n, n, base, [](auto&&) {}, [](auto&&) {});
+    }
+
+    return count;
+}
+
+/// <summary>
+/// Optional callbacks into a seed search. All are called from whichever thread is expanding the seed
+/// </summary>
+struct seed_search_hooks
+{
+    std::function<void(size_t, output_t)> on_seed_done; //seed id and count, as each seed finishes
+    std::function<void(size_t, const seed_resume_point&)> on_seed_checkpoint; //seed id and where to resume it, at most every checkpoint_seconds per thread
+    std::function<const seed_resume_point*(size_t)> get_resume_point; //where to resume a seed from, or nullptr to start it from scratch
+    int checkpoint_seconds = 0; //0 to never checkpoint part way through a seed
+};
+
+enum class job_type
+{
+    ExpandPolyCubes,
+    ExpandSeedRange,
+    ParallelFor,
+    EndProcess
+};
+
+struct expand_poly_cubes_job
+{
+    rooted_polycube base;
+    int n;
+    int spawn_remaining = 0; //Fork join only - children are offered to other workers while more than this many cubes remain, 0 never
+};
+
+struct seed_range_job;
+struct parallel_for_job;
+
+/// <summary>
+/// A job on the queue - its type, and a typed pointer to its payload. Nothing is owned or reference counted:
+/// expand jobs come from the thread pool's job_pool, and are released by whoever runs them,
+/// seed range and parallel for jobs belong to the call that queued them, which waits for every job to finish
+/// </summary>
+struct queue_job
+{
+    job_type type;
+    union
+    {
+        expand_poly_cubes_job* expand;
+        seed_range_job* seed_range;
+        parallel_for_job* parallel_for;
+    };
+
+    //Default is the job that ends a worker
+    queue_job() : type(job_type::EndProcess), expand(nullptr) {}
+    explicit queue_job(expand_poly_cubes_job* job) : type(job_type::ExpandPolyCubes), expand(job) {}
+    explicit queue_job(seed_range_job* job) : type(job_type::ExpandSeedRange), seed_range(job) {}
+    explicit queue_job(parallel_for_job* job) : type(job_type::ParallelFor), parallel_for(job) {}
+};
+
+//Fork join searches offer children to other workers while more than this many cubes remain to be added, and run them inline after
+const int DEFAULT_SPAWN_REMAINING = 6;
+
+//Guided chunking parameters: a chunk takes up to remaining cost / (SEED_CHUNK_DIVISOR * workers), within [1, MAX_SEED_CHUNK] seeds
+const size_t SEED_CHUNK_DIVISOR = 4;
+const size_t MAX_SEED_CHUNK = 64;
+
+/// <summary>
+/// The order seeds are handed to workers in
+/// </summary>
+enum class seed_order
+{
+    Generated, //dfs order, as the seeds were generated
+    LongestFirst //Descending estimated cost, so expensive seeds don't start last and set the wall clock time alone
+};
+
+/// <summary>
+/// An immutable array of seeds, shared by all workers, handed out through a single atomic cursor
+/// </summary>
+struct seed_range_job
+{
+    const std::vector<polycube_seed>* seeds;
+    std::vector<size_t> order; //Ids of the seeds to expand, in the order they're handed out
+    std::vector<size_t> chunk_ends; //End of each chunk, as a position in order
+    std::vector<output_t> seed_counts; //Result for each seed, by id, written once by whichever worker expands it
+    std::vector<uint8_t> seed_done; //Whether each seed, by id, was finished, as a search can be stopped early
+    std::vector<uint64_t> costs; //Estimated cost of each seed, by id, for progress reports
+    seed_search_hooks hooks;
+    int n;
+    padded_value<std::atomic<size_t>> next_chunk; //Claimed by every worker, so kept off the lines holding the fields they read
+
     /// <summary>
-    /// Shuts down all the threads in the pool
+    /// A copy of the seeds local to one NUMA node, made by the first worker on that node to need it, so its pages are placed there
     /// </summary>
-    void shutdown()
+    struct node_replica
+    {
+        std::once_flag copied;
+        std::vector<polycube_seed> seeds;
+    };
+    std::unique_ptr<node_replica[]> replicas; //One per node when workers span several nodes, otherwise empty
+    size_t num_replicas = 0;
+
+    /// <summary>
+    /// The seeds to read from a worker on the given node, -1 if unknown
+    /// </summary>
+    /// <param name="node"></param>
+    /// <returns></returns>
+    inline const std::vector<polycube_seed>& seeds_for_node(int node)
+    {
+        if (node < 0 || (size_t)node >= num_replicas)
+        {
+            return *seeds;
+        }
+
+        node_replica& replica = replicas[node];
+        std::call_once(replica.copied, [&]()
+        {
+            replica.seeds.reserve(seeds->size());
+            advise_huge_pages(replica.seeds);
+            replica.seeds.assign(seeds->begin(), seeds->end());
+        });
+        return replica.seeds;
+    }
+
+    /// <summary>
+    /// Orders the selected seeds and splits them into chunks, given an estimated cost for each seed (by id)
+    /// Chunks start large to keep the cursor cold, and shrink towards single seeds to balance the tail
+    /// </summary>
+    /// <param name="seed_ids"></param>
+    /// <param name="costs"></param>
+    /// <param name="mode"></param>
+    /// <param name="num_workers"></param>
+    inline void plan(const std::vector<size_t>& seed_ids, const std::vector<uint64_t>& costs, seed_order mode, size_t num_workers)
+    {
+        order = seed_ids;
+
+        if (mode == seed_order::LongestFirst)
+        {
+            //Stable, so equal cost seeds keep dfs order and the schedule is reproducible
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+        }
+
+        uint64_t remaining = 0;
+        for (size_t id : order)
+        {
+            remaining += costs[id];
+        }
+
+        chunk_ends.clear();
+        size_t pos = 0;
+        while (pos < order.size())
+        {
+            uint64_t budget = remaining / (SEED_CHUNK_DIVISOR * num_workers);
+            uint64_t chunk_cost = costs[order[pos]];
+            size_t end = pos + 1;
+
+            while (end < order.size() && end - pos < MAX_SEED_CHUNK && chunk_cost + costs[order[end]] <= budget)
+            {
+                chunk_cost += costs[order[end]];
+                end++;
+            }
+
+            chunk_ends.push_back(end);
+            remaining -= chunk_cost;
+            pos = end;
+        }
+
+        next_chunk.value = 0;
+    }
+
+    /// <summary>
+    /// Claims the next chunk of seeds as positions [out_begin, out_end) in order, returns false once every seed has been handed out
+    /// </summary>
+    /// <param name="out_begin"></param>
+    /// <param name="out_end"></param>
+    /// <returns></returns>
+    inline bool claim(size_t& out_begin, size_t& out_end)
+    {
+        size_t chunk = next_chunk.value.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= chunk_ends.size())
+        {
+            return false;
+        }
+
+        out_begin = chunk == 0 ? 0 : chunk_ends[chunk - 1];
+        out_end = chunk_ends[chunk];
+        return true;
+    }
+};
+
+/// <summary>
+/// A loop over [0, count), shared by all workers, which claim grain indices at a time
+/// </summary>
+struct parallel_for_job
+{
+    size_t count;
+    size_t grain;
+    std::function<void(stack_allocator&, size_t)> body;
+    padded_value<std::atomic<size_t>> next_index; //Claimed by every worker, so kept off the lines holding the fields they read
+};
+
+/// <summary>
+/// Counters owned by a single worker. Only that worker writes them, once per seed rather than per polycube,
+/// and the progress reporter samples them with relaxed loads, so they cost nothing in the search itself
+/// </summary>
+struct worker_counters
+{
+    std::atomic<output_t> count;
+    std::atomic<uint64_t> seeds_done;
+    std::atomic<uint64_t> cost_done; //Estimated cost of the seeds done
+
+    inline void reset()
+    {
+        count.store(0, std::memory_order_relaxed);
+        seeds_done.store(0, std::memory_order_relaxed);
+        cost_done.store(0, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Publishes a finished seed. Plain load and store, as only the owning worker writes
+    /// </summary>
+    /// <param name="seed_count"></param>
+    /// <param name="seed_cost"></param>
+    inline void add_seed(output_t seed_count, uint64_t seed_cost)
+    {
+        count.store(count.load(std::memory_order_relaxed) + seed_count, std::memory_order_relaxed);
+        seeds_done.store(seeds_done.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        cost_done.store(cost_done.load(std::memory_order_relaxed) + seed_cost, std::memory_order_relaxed);
+    }
+};
+
+/// <summary>
+/// Everything a worker writes while it searches, in one block made by the worker itself once pinned, so it's placed on the worker's node
+/// Aligned so no two workers' blocks share a cache line, and the counters, which the progress reporter reads, are kept off the lines
+/// of the allocator, which the search writes constantly
+/// </summary>
+struct alignas(FALSE_SHARING_SIZE) worker_state
+{
+    worker_counters counters; //Results of the jobs this worker has run, the pool sums every worker's once the jobs are done
+    alignas(FALSE_SHARING_SIZE) stack_allocator allocator;
+};
+
+struct worker_thread_context
+{
+    thread_safe_queue<queue_job>* job_queue;
+    job_pool<expand_poly_cubes_job>* expand_jobs; //Payloads for expand jobs, released once run
+    worker_state* state; //State owned by this worker, only written by it
+    completion_latch* jobs_pending; //Counted down once per finished job
+    size_t stack_size;
+    int cpu; //Cpu the worker is pinned to, -1 if not pinned
+    int node; //NUMA node of that cpu, -1 if unknown
+    const std::atomic<bool>* stop; //Set to stop the search early, seeds in progress stop at their next checkpoint
+};
+
+/// <summary>
+/// Counts the polycubes of size n from current, fork join style. While more than spawn_remaining cubes remain, each child
+/// is queued as a job for an idle worker to steal, or run inline if the queue is full. Below that, subtrees run inline as a plain dfs
+/// Granularity adapts by itself - with idle workers the queue drains and children are spawned, with busy ones it fills and they're inlined
+/// Returns the count of the subtrees run here, stolen ones are counted by the worker that runs them
+/// Once stopped, every subtree not yet started is abandoned, leaving a partial count that the pool reports as such
+/// </summary>
+/// <param name="ctx"></param>
+/// <param name="allocator"></param>
+/// <param name="n"></param>
+/// <param name="current"></param>
+/// <param name="spawn_remaining"></param>
+/// <returns></returns>
+inline output_t expand_polycubes_fork_join(worker_thread_context& ctx, stack_allocator& allocator, int n, rooted_polycube& current, int spawn_remaining)
+{
+    if (ctx.stop->load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+
+    output_t count = 0;
+
+    if (n - current.k <= spawn_remaining)
+    {
+        //Run inline, but as subtrees no bigger than the ones checkpoints are taken between, so a stop is seen within one of them
+        int frontier_size = std::max(current.k + 1, n - CHECKPOINT_SUBTREE_DEPTH);
+        output_t leaves = expand_polycubes_dfs_from_current(allocator, n, frontier_size, current, [](auto&&) {}, [&](rooted_polycube& frontier) {
+            if (!ctx.stop->load(std::memory_order_relaxed))
+            {
+                count += expand_polycubes_dfs_from_current(allocator, n, n, frontier, [](auto&&) {}, [](auto&&) {});
+            }
+        });
+        return count + leaves;
+    }
+
+    expand_polycubes_dfs_from_current(allocator, n, current.k + 1, current, [](auto&&) {}, [&](rooted_polycube& child) {
+        //Once stopped, the children left are neither spawned nor run
+        if (ctx.stop->load(std::memory_order_relaxed))
+        {
+            return;
+        }
+
+        //With every payload in use, the queue is as good as full
+        expand_poly_cubes_job* spawned = ctx.expand_jobs->acquire();
+        if (!spawned)
+        {
+            count += expand_polycubes_fork_join(ctx, allocator, n, child, spawn_remaining);
+            return;
+        }
+
+        spawned->base = child;
+        spawned->n = n;
+        spawned->spawn_remaining = spawn_remaining;
+
+        //Must be added before the job is visible to workers, so the latch can't reach zero early
+        ctx.jobs_pending->add(1);
+        if (!ctx.job_queue->try_enqueue(queue_job(spawned)))
+        {
+            ctx.jobs_pending->count_down();
+            ctx.expand_jobs->release(spawned);
+            count += expand_polycubes_fork_join(ctx, allocator, n, child, spawn_remaining);
+        }
+    });
+
+    return count;
+}
+
+/// <summary>
+/// Runs a single job from the job queue, returns false if the job asks the thread to stop
+/// Used by the workers, and by the thread generating jobs once it has finished generating
+/// </summary>
+/// <param name="ctx"></param>
+/// <param name="allocator"></param>
+/// <param name="job"></param>
+/// <returns></returns>
+bool run_polycubes_job(worker_thread_context& ctx, stack_allocator& allocator, const queue_job& job)
+{
+    switch (job.type)
+    {
+    case job_type::ExpandPolyCubes:
+        scope {
+            expand_poly_cubes_job* expand_job = job.expand;
+
+            //Jobs still queued once stopped are dropped, their counts are left out
+            if (ctx.stop->load(std::memory_order_relaxed))
+            {
+                ctx.expand_jobs->release(expand_job);
+                ctx.jobs_pending->count_down();
+                return true;
+            }
+
+            size_t output = expand_job->spawn_remaining > 0
+                ? expand_polycubes_fork_join(ctx, allocator, expand_job->n, expand_job->base, expand_job->spawn_remaining)
+                : expand_polycubes_dfs_from_current(allocator, expand_job->n, expand_job->n, expand_job->base, [](auto&&) {}, [](auto&&) {});
+
+            //Accumulate locally, the pool reduces all the slots once every job is done
+            ctx.state->counters.add_seed(output, 1);
+            ctx.expand_jobs->release(expand_job);
+            ctx.jobs_pending->count_down();
+        }
+        return true;
+    case job_type::ExpandSeedRange:
+        scope {
+            seed_range_job* range_job = job.seed_range;
+            const std::vector<polycube_seed>& seeds = range_job->seeds_for_node(ctx.node);
+
+            size_t begin, end;
+            while (!ctx.stop->load(std::memory_order_relaxed) && range_job->claim(begin, end))
+            {
+                for (size_t i = begin; i < end && !ctx.stop->load(std::memory_order_relaxed); i++)
+                {
+                    size_t id = range_job->order[i];
+
+                    stack_marker marker(allocator);
+                    rooted_polycube* base = build_rooted_from_seed(allocator, seeds[id]);
+
+                    const seed_search_hooks& hooks = range_job->hooks;
+                    const seed_resume_point* resume = hooks.get_resume_point ? hooks.get_resume_point(id) : nullptr;
+
+                    //Searched as subtrees, so a stop is seen within a subtree's time, and can leave a checkpoint to resume from
+                    auto last_checkpoint = std::chrono::steady_clock::now();
+                    bool stopped = false;
+                    output_t output = expand_polycubes_checkpointed(allocator, range_job->n, *base, resume, [&](output_t partial_count, const rooted_polycube& frontier) {
+                        bool stopping = ctx.stop->load(std::memory_order_relaxed);
+                        if (hooks.checkpoint_seconds > 0 && hooks.on_seed_checkpoint)
+                        {
+                            auto now = std::chrono::steady_clock::now();
+                            if (stopping || now - last_checkpoint >= std::chrono::seconds(hooks.checkpoint_seconds))
+                            {
+                                last_checkpoint = now;
+                                seed_resume_point point{ partial_count, std::vector<uint8_t>(&frontier.filled_cubes.labels[1], &frontier.filled_cubes.labels[frontier.k]) };
+                                hooks.on_seed_checkpoint(id, point);
+                            }
+                        }
+                        return !stopping;
+                    }, &stopped);
+
+                    if (stopped)
+                    {
+                        break;
+                    }
+
+                    range_job->seed_counts[id] = output;
+                    range_job->seed_done[id] = 1;
+                    ctx.state->counters.add_seed(output, range_job->costs[id]);
+
+                    if (hooks.on_seed_done)
+                    {
+                        hooks.on_seed_done(id, output);
+                    }
+                }
+            }
+
+            //One range job is handed to each worker, and is done once it runs out of seeds
+            ctx.jobs_pending->count_down();
+        }
+        return true;
+    case job_type::ParallelFor:
+        scope {
+            parallel_for_job* for_job = job.parallel_for;
+
+            size_t begin;
+            while ((begin = for_job->next_index.value.fetch_add(for_job->grain, std::memory_order_relaxed)) < for_job->count)
+            {
+                size_t end = std::min(begin + for_job->grain, for_job->count);
+                for (size_t i = begin; i < end; i++)
+                {
+                    stack_marker marker(allocator);
+                    for_job->body(allocator, i);
+                }
+            }
+
+            ctx.jobs_pending->count_down();
+        }
+        return true;
+    case job_type::EndProcess:
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Worker thread function for polycube expander
+/// </summary>
+/// <param name="ctx"></param>
+/// <param name="id"></param>
+/// <param name="out_state">where the worker's state is kept, the pool reads its counters from there</param>
+/// <param name="started">counted down once the state is made</param>
+void polycubes_worker_thread(worker_thread_context ctx, int id, aligned_ptr<worker_state>* out_state, completion_latch* started)
+{
+    //Pinned before the state is made, so it and the allocator's chunks are first touched, and so placed, on this worker's node
+    if (ctx.cpu >= 0 && !pin_current_thread(ctx.cpu))
+    {
+        printf("Error! could not pin worker %d to cpu %d, leaving it unpinned\n", id, ctx.cpu);
+    }
+
+    *out_state = make_aligned<worker_state>();
+    ctx.state = out_state->get();
+    ctx.state->counters.reset();
+    started->count_down();
+
+    stack_allocator& allocator = ctx.state->allocator;
+
+    //printf("Starting Thread %d\n", id);
+    bool running = true;
+    while (running)
+    {
+        queue_job job = ctx.job_queue->blocking_dequeue();
+        running = run_polycubes_job(ctx, allocator, job);
+    }
+}
+
+//Bound on the job queue, per worker - enough to keep workers busy, without holding every seed in memory at once
+const size_t JOBS_QUEUED_PER_WORKER = 4;
+
+//Jobs found by the generating thread are published this many at a time, with one lock of the queue
+const size_t JOBS_PUBLISHED_PER_BATCH = 8;
+
+//Default size of the seeds the search is split on
+const int DEFAULT_SPLIT_DEPTH = 5;
+
+//Seeds at least this size are generated in parallel, from seeds PREFIX_SPLIT_DELTA cubes smaller
+const int PARALLEL_PREFIX_MIN_SIZE = 7;
+const int PREFIX_SPLIT_DELTA = 3;
+
+/// <summary>
+/// How the pool hands work to its workers
+/// </summary>
+enum class dispatch_mode
+{
+    JobQueue, //One queued job per seed, as the seeds are found
+    SeedArray, //All seeds found up front, workers claim chunks of them through an atomic cursor
+    ForkJoin //No fixed split, large subtrees are spawned as jobs for idle workers, see expand_polycubes_fork_join
+};
+
+/// <summary>
+/// Thread pool for managin parallel execution of polycube expanders
+/// </summary>
+class polycubes_thread_pool
+{
+
+public:
+    /// <summary>
+    /// Initialized the threads in the pool
+    /// </summary>
+    /// <param name="k"></param>
+    void init(size_t k)
+    {
+        if (k < 1)
+        {
+            printf("Error! no worker threads\n");
+            return;
+        }
+
+        //Bounded, so generating jobs is held back while the workers catch up
+        m_job_queue.set_bound((int64_t)(k * JOBS_QUEUED_PER_WORKER));
+
+        //A payload for every job the queue can hold, one for every thread running a job, a batch waiting to be published, and the fork join root
+        m_expand_jobs.init(k * JOBS_QUEUED_PER_WORKER + (k + 1) + JOBS_PUBLISHED_PER_BATCH + 1);
+
+        //Each worker makes its own state, the extra slot is for the thread calling generate_polycubes_parallel, once it joins in
+        m_states = std::unique_ptr<aligned_ptr<worker_state>[]>(new aligned_ptr<worker_state>[k + 1]);
+        m_num_states = k + 1;
+
+        m_states[k] = make_aligned<worker_state>();
+        m_states[k]->counters.reset();
+        //The calling thread is left where it is, and reads the shared seeds
+        m_caller_context = worker_thread_context{ &m_job_queue, &m_expand_jobs, m_states[k].get(), &m_jobs_pending, (size_t)-1, -1, -1, &m_stop };
+
+        std::vector<cpu_info> placement = plan_worker_cpus(m_affinity, m_affinity_cpus, get_cpu_topology(), k);
+        int max_node = -1;
+        for (const cpu_info& info : placement)
+        {
+            max_node = std::max(max_node, info.node);
+        }
+        m_num_nodes = (size_t)(max_node + 1);
+
+        if (m_affinity != affinity_policy::None)
+        {
+            printf("Pinning %llu workers across %llu NUMA nodes\n", (unsigned long long)k, (unsigned long long)std::max(m_num_nodes, (size_t)1));
+        }
+
+        completion_latch started;
+        started.add(k);
+        for (int i = 0; i < k; i++)
+        {
+            worker_thread_context context{ &m_job_queue, &m_expand_jobs, nullptr, &m_jobs_pending, (size_t)-1, placement[i].cpu, placement[i].node, &m_stop };
+            m_worker_threads.push_back(std::thread(polycubes_worker_thread, context, i, &m_states[i], &started));
+        }
+
+        //Every state exists before a search can read its counters
+        started.wait();
+    }
+
+    /// <summary>
+    /// Asks the running search, and any later ones, to stop early. Workers finish or checkpoint the seed they're on
+    /// Only stores to a lock free atomic, so is safe to call from a signal handler
+    /// </summary>
+    inline void request_stop()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+    }
+
+    inline bool stop_requested() const
+    {
+        return m_stop.load(std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Whether the last search was stopped before it finished, in which case its counts only cover the seeds completed
+    /// </summary>
+    /// <returns></returns>
+    inline bool was_stopped() const
+    {
+        return m_search_stopped;
+    }
+
+    /// <summary>
+    /// Sets how workers are placed on cpus, must be called before init
+    /// </summary>
+    /// <param name="policy"></param>
+    /// <param name="cpus">cpus for affinity_policy::List, worker i runs on cpus[i % size]</param>
+    void set_affinity(affinity_policy policy, const std::vector<int>& cpus = std::vector<int>())
+    {
+        m_affinity = policy;
+        m_affinity_cpus = cpus;
+    }
+
+    /// <summary>
+    /// Sets how work is handed out to the workers by later calls to generate_polycubes_parallel
+    /// </summary>
+    /// <param name="mode"></param>
+    void set_dispatch_mode(dispatch_mode mode)
+    {
+        m_dispatch_mode = mode;
+    }
+
+    /// <summary>
+    /// Sets the size of the seeds the search is split on. Deeper splits give more, smaller, seeds for larger thread counts
+    /// Returns false if the depth is out of range
+    /// </summary>
+    /// <param name="depth"></param>
+    /// <returns></returns>
+    bool set_split_depth(int depth)
+    {
+        if (depth < 3 || depth > MAX_SEED_SIZE)
+        {
+            printf("Error! split depth must be between 3 and %d\n", MAX_SEED_SIZE);
+            return false;
+        }
+
+        if (depth != m_split_depth)
+        {
+            std::vector<polycube_seed>().swap(m_seeds);
+            std::vector<uint64_t>().swap(m_seed_costs);
+        }
+        m_split_depth = depth;
+        return true;
+    }
+
+    inline int get_split_depth() const
+    {
+        return m_split_depth;
+    }
+
+    /// <summary>
+    /// Sets how many cubes must remain to be added for a fork join search to still offer children to other workers
+    /// Lower spawns smaller tasks, higher runs more inline. Returns false if it's not at least 1
+    /// </summary>
+    /// <param name="remaining"></param>
+    /// <returns></returns>
+    bool set_spawn_remaining(int remaining)
+    {
+        if (remaining < 1)
+        {
+            printf("Error! spawn threshold must be at least 1\n");
+            return false;
+        }
+        m_spawn_remaining = remaining;
+        return true;
+    }
+
+    /// <summary>
+    /// Sets how often progress is printed during later searches, 0 (the default) for never
+    /// </summary>
+    /// <param name="seconds"></param>
+    void set_progress_interval(int seconds)
+    {
+        m_progress_interval = seconds;
+    }
+
+    /// <summary>
+    /// Samples the progress of the running search, from any thread. Counts only include finished seeds
+    /// </summary>
+    /// <returns></returns>
+    search_progress sample_progress() const
+    {
+        search_progress progress{ 0, m_seeds_total.load(std::memory_order_relaxed), 0, m_cost_total.load(std::memory_order_relaxed), 0 };
+        for (size_t i = 0; i < m_num_states; i++)
+        {
+            const worker_counters& counters = m_states[i]->counters;
+            progress.count += counters.count.load(std::memory_order_relaxed);
+            progress.seeds_done += counters.seeds_done.load(std::memory_order_relaxed);
+            progress.cost_done += counters.cost_done.load(std::memory_order_relaxed);
+        }
+        return progress;
+    }
+
+    /// <summary>
+    /// Runs body(allocator, i) for every i in [0, count) on the workers and the calling thread, returning once all are done
+    /// body gets the allocator of the thread running it, and a marker is released after each call
+    /// </summary>
+    /// <param name="allocator"></param>
+    /// <param name="count"></param>
+    /// <param name="grain">number of indices claimed at a time</param>
+    /// <param name="body"></param>
+    void parallel_for(stack_allocator& allocator, size_t count, size_t grain, std::function<void(stack_allocator&, size_t)> body)
+    {
+        parallel_for_job for_job;
+        for_job.count = count;
+        for_job.grain = std::max(grain, (size_t)1);
+        for_job.body = std::move(body);
+
+        m_jobs_pending.add(m_worker_threads.size() + 1);
+        std::vector<queue_job> jobs(m_worker_threads.size(), queue_job(&for_job));
+        m_job_queue.enqueue_bulk(jobs.begin(), jobs.end());
+
+        run_polycubes_job(m_caller_context, allocator, queue_job(&for_job));
+        help_until_done(allocator);
+    }
+
+    /// <summary>
+    /// Finds every seed of size m, in the same order as generate_seeds, so seed ids are reproducible
+    /// Large seeds are split on seeds a few cubes smaller, which are expanded across the pool
+    /// </summary>
+    /// <param name="allocator"></param>
+    /// <param name="m"></param>
+    /// <returns></returns>
+    std::vector<polycube_seed> generate_seeds_parallel(stack_allocator& allocator, int m)
+    {
+        if (m < PARALLEL_PREFIX_MIN_SIZE)
+        {
+            return generate_seeds(allocator, m);
+        }
+
+        std::vector<polycube_seed> prefixes = generate_seeds(allocator, m - PREFIX_SPLIT_DELTA);
+        std::vector<std::vector<polycube_seed>> expanded(prefixes.size());
+
+        parallel_for(allocator, prefixes.size(), 1, [&](stack_allocator& local_allocator, size_t i) {
+            generate_seeds_from(local_allocator, prefixes[i], m, expanded[i]);
+        });
+
+        size_t total = 0;
+        for (const std::vector<polycube_seed>& seeds : expanded)
+        {
+            total += seeds.size();
+        }
+
+        std::vector<polycube_seed> seeds;
+        seeds.reserve(total);
+        for (std::vector<polycube_seed>& part : expanded)
+        {
+            seeds.insert(seeds.end(), part.begin(), part.end());
+            std::vector<polycube_seed>().swap(part);
+        }
+
+        return seeds;
+    }
+
+    /// <summary>
+    /// The seeds of the current split depth, generated on first use and kept for later searches
+    /// Seeds don't depend on n, so a sweep over several n only generates them once
+    /// </summary>
+    /// <returns></returns>
+    const std::vector<polycube_seed>& get_seeds()
+    {
+        if (m_seeds.empty())
+        {
+            m_seeds = generate_seeds_parallel(caller_allocator(), m_split_depth);
+            advise_huge_pages(m_seeds);
+        }
+        return m_seeds;
+    }
+
+    /// <summary>
+    /// Sets the order seeds are handed out in, when using dispatch_mode::SeedArray
+    /// </summary>
+    /// <param name="order"></param>
+    void set_seed_order(seed_order order)
+    {
+        m_seed_order = order;
+    }
+
+    /// <summary>
+    /// Computes the number of polycubes of size n using parrallel threads
+    /// </summary>
+    /// <param name="base_cubes"></param>
+    /// <param name="n"></param>
+    /// <returns></returns>
+    size_t generate_polycubes_parallel(int n)
+    {
+        //Kept between calls, along with the workers' own allocators
+        stack_allocator& allocator = caller_allocator();
+
+        if (n <= m_split_depth)
+        {
+            //Not big enough to care, expand single threaded
+            m_search_stopped = false;
+            return expand_polycubes_dfs(allocator, n, n, [](auto&&) {}, [](auto&&) {});
+        }
+
+        switch (m_dispatch_mode)
+        {
+        case dispatch_mode::JobQueue:
+            //Seeds are only found as the search goes, so there's no total to report against
+            m_seeds_total = 0;
+            m_cost_total = 0;
+            m_reporter.start(m_progress_interval, [this]() { return sample_progress(); });
+
+            expand_through_job_queue(allocator, n, m_split_depth);
+
+            //Generation is done, so act as another worker until every job is finished
+            help_until_done(allocator);
+            m_reporter.stop();
+            m_search_stopped = stop_requested();
+            return collect_output_counts();
+        case dispatch_mode::ForkJoin:
+            {
+                //The whole search is one task, which the calling thread starts on, and the rest is stolen from it
+                m_seeds_total = 0;
+                m_cost_total = 0;
+                m_reporter.start(m_progress_interval, [this]() { return sample_progress(); });
+
+                expand_poly_cubes_job* root_job = m_expand_jobs.acquire();
+                init_single_cube(root_job->base);
+                root_job->n = n;
+                root_job->spawn_remaining = m_spawn_remaining;
+
+                m_jobs_pending.add(1);
+                run_polycubes_job(m_caller_context, allocator, queue_job(root_job));
+
+                help_until_done(allocator);
+                m_reporter.stop();
+                m_search_stopped = stop_requested();
+                return collect_output_counts();
+            }
+        case dispatch_mode::SeedArray:
+            {
+                const std::vector<polycube_seed>& seeds = get_seeds();
+                std::vector<size_t> seed_ids(seeds.size());
+                for (size_t i = 0; i < seed_ids.size(); i++)
+                {
+                    seed_ids[i] = i;
+                }
+
+                return expand_seeds(allocator, n, seeds, seed_ids);
+            }
+        }
+
+        return 0;
+    }
+
+    /// <summary>
+    /// Counts the polycubes of size n descended from the selected seeds, which must all be smaller than n
+    /// Seeds are handed out to the workers from one shared array, and the calling thread joins in
+    /// Returns the total, and optionally the count for each seed by id (0 for seeds not selected)
+    /// hooks are called from the workers as seeds finish, and to checkpoint and resume seeds part way through
+    /// If the search is stopped early, the total and counts only cover the seeds finished, which out_seed_done marks
+    /// </summary>
+    /// <param name="allocator"></param>
+    /// <param name="n"></param>
+    /// <param name="seeds"></param>
+    /// <param name="seed_ids">ids of the seeds to expand</param>
+    /// <param name="out_seed_counts"></param>
+    /// <param name="hooks"></param>
+    /// <param name="out_seed_done"></param>
+    /// <returns></returns>
+    size_t expand_seeds(stack_allocator& allocator, int n, const std::vector<polycube_seed>& seeds, const std::vector<size_t>& seed_ids,
+        std::vector<output_t>* out_seed_counts = nullptr, const seed_search_hooks& hooks = seed_search_hooks(), std::vector<uint8_t>* out_seed_done = nullptr)
     {
-        for (int i = 0; i < m_worker_threads.size(); i++)
+        std::unique_ptr<seed_range_job> range_job(new seed_range_job());
+        range_job->seeds = &seeds;
+        range_job->seed_counts.assign(seeds.size(), 0);
+        range_job->seed_done.assign(seeds.size(), 0);
+        range_job->hooks = hooks;
+        range_job->n = n;
+
+        //Workers on different nodes each read their own copy of the seeds
+        if (m_num_nodes > 1)
+        {
+            range_job->replicas = std::unique_ptr<seed_range_job::node_replica[]>(new seed_range_job::node_replica[m_num_nodes]);
+            range_job->num_replicas = m_num_nodes;
+        }
+
+        std::vector<uint64_t> costs(seeds.size(), 1);
+        if (m_seed_order == seed_order::LongestFirst)
+        {
+            //Estimates of the pool's own seeds are kept for the next n with the same probe size, 0 until estimated
+            bool cache = &seeds == &m_seeds;
+            int probe_size = seed_probe_size(m_split_depth, n);
+            if (cache && (m_seed_costs.size() != seeds.size() || m_seed_costs_probe_size != probe_size))
+            {
+                m_seed_costs.assign(seeds.size(), 0);
+                m_seed_costs_probe_size = probe_size;
+            }
+
+            parallel_for(allocator, seed_ids.size(), MAX_SEED_CHUNK, [&](stack_allocator& local_allocator, size_t i) {
+                size_t id = seed_ids[i];
+                if (!cache)
+                {
+                    costs[id] = estimate_seed_cost(local_allocator, seeds[id], n);
+                    return;
+                }
+
+                if (m_seed_costs[id] == 0)
+                {
+                    m_seed_costs[id] = estimate_seed_cost(local_allocator, seeds[id], n);
+                }
+                costs[id] = m_seed_costs[id];
+            });
+        }
+
+        //The calling thread joins in once the jobs are queued, so counts as a worker
+        range_job->plan(seed_ids, costs, m_seed_order, m_worker_threads.size() + 1);
+
+        uint64_t cost_total = 0;
+        for (size_t id : seed_ids)
+        {
+            cost_total += costs[id];
+        }
+        range_job->costs = std::move(costs);
+
+        m_seeds_total = seed_ids.size();
+        m_cost_total = cost_total;
+        m_reporter.start(m_progress_interval, [this]() { return sample_progress(); });
+
+        m_jobs_pending.add(m_worker_threads.size());
+        std::vector<queue_job> jobs(m_worker_threads.size(), queue_job(range_job.get()));
+        m_job_queue.enqueue_bulk(jobs.begin(), jobs.end());
+
+        help_until_done(allocator);
+        m_reporter.stop();
+
+        m_search_stopped = false;
+        for (size_t id : seed_ids)
+        {
+            m_search_stopped = m_search_stopped || !range_job->seed_done[id];
+        }
+
+        if (out_seed_counts)
+        {
+            *out_seed_counts = std::move(range_job->seed_counts);
+        }
+        if (out_seed_done)
         {
-            m_job_queue.enqueue({ job_type::EndProcess, nullptr });
+            *out_seed_done = std::move(range_job->seed_done);
         }
 
+        return collect_output_counts();
+    }
+
+    /// <summary>
+    /// Shuts down all the threads in the pool
+    /// </summary>
+    void shutdown()
+    {
+        std::vector<queue_job> jobs(m_worker_threads.size());
+        m_job_queue.enqueue_bulk(jobs.begin(), jobs.end());
+
         for (auto& thread : m_worker_threads)
         {
             thread.join();
@@ -716,9 +1919,110 @@ public:
     }
 
 private:
+
+    /// <summary>
+    /// Runs queued jobs on the calling thread until there are none left to pick up, then waits for the workers to finish theirs
+    /// </summary>
+    /// <param name="allocator"></param>
+    void help_until_done(stack_allocator& allocator)
+    {
+        queue_job job;
+        while (m_job_queue.dequeue(job))
+        {
+            run_polycubes_job(m_caller_context, allocator, job);
+        }
+
+        m_jobs_pending.wait();
+    }
+
+    /// <summary>
+    /// Queues one job per rooted polycube of size m, as they're found, in batches of JOBS_PUBLISHED_PER_BATCH
+    /// The workers expand them while generation continues, the bounded queue blocks generation if they fall behind
+    /// </summary>
+    void expand_through_job_queue(stack_allocator& allocator, int n, int m)
+    {
+        std::vector<queue_job> batch;
+        batch.reserve(JOBS_PUBLISHED_PER_BATCH);
+
+        auto publish = [&]() {
+            //Must be added before the jobs are visible to workers, so the latch can't reach zero early
+            m_jobs_pending.add(batch.size());
+            m_job_queue.enqueue_bulk(batch.begin(), batch.end());
+            batch.clear();
+        };
+
+        expand_polycubes_dfs(allocator, n, m, [](auto&&) {}, [&](const rooted_polycube& pc) {
+            //The job pool has a payload for every job the queue can hold, every job being run, and a batch, so is never short here
+            expand_poly_cubes_job* expand_job = m_expand_jobs.acquire();
+            expand_job->base = pc;
+            expand_job->n = n;
+            expand_job->spawn_remaining = 0;
+
+            batch.push_back(queue_job(expand_job));
+            if (batch.size() == JOBS_PUBLISHED_PER_BATCH)
+            {
+                publish();
+            }
+        });
+
+        if (!batch.empty())
+        {
+            publish();
+        }
+    }
+
+    /// <summary>
+    /// Allocator of the thread calling into the pool, only valid once the pool is initialized
+    /// </summary>
+    /// <returns></returns>
+    inline stack_allocator& caller_allocator()
+    {
+        return m_states[m_num_states - 1]->allocator;
+    }
+
+    /// <summary>
+    /// Sums the per thread counts, and resets them for the next search
+    /// Only valid once every job has finished
+    /// </summary>
+    /// <returns></returns>
+    size_t collect_output_counts()
+    {
+        size_t num_polycubes = 0;
+
+        for (size_t i = 0; i < m_num_states; i++)
+        {
+            num_polycubes += m_states[i]->counters.count.load(std::memory_order_relaxed);
+            m_states[i]->counters.reset();
+        }
+
+        return num_polycubes;
+    }
+
     //NOTE: could be high sources of contention
     thread_safe_queue<queue_job> m_job_queue;
-    thread_safe_queue<output_t> m_output_queue;
+    job_pool<expand_poly_cubes_job> m_expand_jobs;
+    worker_thread_context m_caller_context;
+    dispatch_mode m_dispatch_mode = dispatch_mode::SeedArray;
+    seed_order m_seed_order = seed_order::LongestFirst;
+    int m_split_depth = DEFAULT_SPLIT_DEPTH;
+    int m_spawn_remaining = DEFAULT_SPAWN_REMAINING;
+    std::vector<polycube_seed> m_seeds; //Seeds of size m_split_depth, empty until first needed
+    std::vector<uint64_t> m_seed_costs; //Cost estimates of m_seeds, by id, for probes of m_seed_costs_probe_size
+    int m_seed_costs_probe_size = 0;
+    affinity_policy m_affinity = affinity_policy::None;
+    std::vector<int> m_affinity_cpus;
+    size_t m_num_nodes = 0; //Number of NUMA nodes the workers are pinned across, 0 if unpinned
+
+    //Per worker state, each block on its own cache lines, so accumulating counts doesn't cause false sharing. The last is the calling thread's
+    std::unique_ptr<aligned_ptr<worker_state>[]> m_states;
+    size_t m_num_states = 0;
+    std::atomic<uint64_t> m_seeds_total{ 0 };
+    std::atomic<uint64_t> m_cost_total{ 0 };
+    int m_progress_interval = 0;
+    progress_reporter m_reporter;
+    std::atomic<bool> m_stop{ false };
+    bool m_search_stopped = false;
+    completion_latch m_jobs_pending;
 
     std::vector<std::thread> m_worker_threads;
 };
@@ -731,24 +2035,31 @@ private:
 /// <returns></returns>
 inline size_t generate_polycubes_threaded(int n, polycubes_thread_pool& pool)
 {
-    if (n < 1)
+    if (n < 1 || !check_polycube_size(n))
     {
         return 0;
     }
-    else if (n == 1)
+
+    size_t num_cubes = 0;
+
+    if (n == 1 || n == 2)
     {
-        return 1;
+        num_cubes = 1;
     }
-    else if (n == 2)
+    else
     {
-        return 1;
+        num_cubes = pool.generate_polycubes_parallel(n);
     }
 
-    size_t num_cubes = 0;
-
-    num_cubes = pool.generate_polycubes_parallel(n);
-
-    printf("For n = {%d}, found {%llu} polycubes\n", n, num_cubes);
+    if (pool.was_stopped())
+    {
+        printf("Stopped early for n = {%d}: found {%llu} polycubes in the seeds finished, this is not the full count\n", n, (unsigned long long)num_cubes);
+    }
+    else
+    {
+        printf("For n = {%d}, found {%llu} polycubes\n", n, (unsigned long long)num_cubes);
+    }
+    fflush(stdout);
 
     return num_cubes;
 }
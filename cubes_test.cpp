@@ -1,7 +1,15 @@
 #include "catch_amalgamated.hpp"
 
 #include "cubes.h"
+#include "dfs_coroutine.h"
+#include "seed_coordinator.h"
+#include "seed_journal.h"
+#include "seed_results.h"
 
+#include <algorithm>
+#include <set>
+#include <string>
+#include <type_traits>
 #include <utility>
 
 //I realize that there should be more unit tests - there were in a previous iteration of the code, 
@@ -25,4 +33,821 @@ TEST_CASE("CHECK THAT DFS expansion is correct")
     uint64_t result = expand_polycubes_dfs(allocator, n_cubes_pair.first, n_cubes_pair.first, [](auto&&) {}, [](auto&&) {});
 
     REQUIRE(result == n_cubes_pair.second);
-}
\ No newline at end of file
+}
+
+TEST_CASE("CHECK THAT seeds rebuild the polycubes they were made from")
+{
+    stack_allocator allocator;
+    std::vector<polycube_seed> seeds = generate_seeds(allocator, 5);
+
+    //Counting from every rebuilt seed must give the same answer as a single dfs
+    uint64_t total = 0;
+    for (const polycube_seed& seed : seeds)
+    {
+        stack_marker marker(allocator);
+        rooted_polycube* base = build_rooted_from_seed(allocator, seed);
+        REQUIRE(base->k == 5);
+
+        total += expand_polycubes_dfs_from_current(allocator, 8, 8, *base, [](auto&&) {}, [](auto&&) {});
+    }
+
+    REQUIRE(total == 6922LLu);
+}
+
+TEST_CASE("CHECK THAT thread pool dispatch modes are correct")
+{
+    dispatch_mode mode = GENERATE(dispatch_mode::JobQueue, dispatch_mode::SeedArray, dispatch_mode::ForkJoin);
+    seed_order order = GENERATE(seed_order::Generated, seed_order::LongestFirst);
+
+    polycubes_thread_pool pool;
+    pool.init(3);
+    pool.set_dispatch_mode(mode);
+    pool.set_seed_order(order);
+
+    REQUIRE(pool.generate_polycubes_parallel(7) == 1023LLu);
+    REQUIRE(pool.generate_polycubes_parallel(8) == 6922LLu);
+    //Probes the same depth as n = 8, so reuses its seed cost estimates
+    REQUIRE(pool.generate_polycubes_parallel(9) == 48311LLu);
+
+    REQUIRE(pool.set_split_depth(4));
+    REQUIRE(pool.generate_polycubes_parallel(8) == 6922LLu);
+
+    pool.shutdown();
+}
+
+TEST_CASE("CHECK THAT a stopped fork join search abandons what's left")
+{
+    //Above the spawn threshold children are spawned, below it they're run inline, both must see the stop
+    //Both thresholds are low enough for the root job to spawn its children rather than running the whole search
+    int spawn_remaining = GENERATE(6, 8);
+
+    polycubes_thread_pool pool;
+    pool.init(2);
+    pool.set_dispatch_mode(dispatch_mode::ForkJoin);
+    REQUIRE(pool.set_spawn_remaining(spawn_remaining));
+
+    REQUIRE(pool.generate_polycubes_parallel(8) == 6922LLu);
+    REQUIRE(!pool.was_stopped());
+
+    //n = 13 takes minutes. The root job is done once it has spawned its children, so stop then, with the rest part way through
+    std::atomic<bool> finished{ false };
+    search_progress progress{};
+    std::thread stopper([&]() {
+        while (!finished && (progress = pool.sample_progress()).seeds_done == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pool.request_stop();
+    });
+    size_t partial = pool.generate_polycubes_parallel(13);
+    finished = true;
+    stopper.join();
+
+    REQUIRE(pool.was_stopped());
+    REQUIRE(progress.seeds_done > 0);
+    REQUIRE(partial < 138462649LLu);
+
+    pool.shutdown();
+}
+
+TEST_CASE("CHECK THAT a seed resumed from a checkpoint gives the same count")
+{
+    stack_allocator allocator;
+    rooted_polycube* base = allocator.allocate();
+    init_single_cube(*base);
+
+    //Take a checkpoint part way through the frontier, then resume from it
+    std::vector<seed_resume_point> checkpoints;
+    output_t full = expand_polycubes_checkpointed(allocator, 9, *base, nullptr, [&](output_t partial_count, const rooted_polycube& frontier) {
+        checkpoints.push_back({ partial_count, std::vector<uint8_t>(&frontier.filled_cubes.labels[1], &frontier.filled_cubes.labels[frontier.k]) });
+        return true;
+    });
+    REQUIRE(full == 48311LLu);
+    REQUIRE(checkpoints.size() > 2);
+
+    output_t resumed = expand_polycubes_checkpointed(allocator, 9, *base, &checkpoints[checkpoints.size() / 2], [](auto&&...) { return true; });
+    REQUIRE(resumed == full);
+
+    //Stopping at a checkpoint reports the count up to it, and resuming from there finishes the count
+    size_t checkpoints_seen = 0;
+    bool stopped = false;
+    output_t partial = expand_polycubes_checkpointed(allocator, 9, *base, nullptr, [&](auto&&...) { return ++checkpoints_seen <= checkpoints.size() / 3; }, &stopped);
+    REQUIRE(stopped);
+    REQUIRE(partial == checkpoints[checkpoints.size() / 3].partial_count);
+
+    resumed = expand_polycubes_checkpointed(allocator, 9, *base, &checkpoints[checkpoints.size() / 3], [](auto&&...) { return true; }, &stopped);
+    REQUIRE(!stopped);
+    REQUIRE(resumed == full);
+}
+
+TEST_CASE("CHECK THAT a stopped journaled search resumes from its partial records to the full count")
+{
+    const std::string path = "test_checkpoint_journal.txt";
+    std::remove(path.c_str());
+
+    //Seeds of 3 cubes leave room for checkpointed subtrees above n - CHECKPOINT_SUBTREE_DEPTH
+    const int n = 10;
+    auto run = [&](bool stop_early, bool resume, size_t& out_num_partial) {
+        polycubes_thread_pool pool;
+        pool.init(2);
+        REQUIRE(pool.set_split_depth(3));
+        const std::vector<polycube_seed>& seeds = pool.get_seeds();
+        std::vector<size_t> all_ids(seeds.size());
+        for (size_t id = 0; id < all_ids.size(); id++)
+        {
+            all_ids[id] = id;
+        }
+
+        seed_journal journal;
+        REQUIRE(journal.open(path, { n, 3, seeds.size(), hash_seeds(seeds), 0, 1 }, resume));
+
+        std::vector<size_t> seed_ids;
+        out_num_partial = 0;
+        for (size_t id : all_ids)
+        {
+            if (!journal.is_done(id))
+            {
+                seed_ids.push_back(id);
+                out_num_partial += journal.resume_point(id) != nullptr && journal.resume_point(id)->partial_count > 0;
+            }
+        }
+
+        seed_search_hooks hooks;
+        hooks.on_seed_done = [&](size_t id, output_t count) { journal.record(id, count); };
+        hooks.on_seed_checkpoint = [&](size_t id, const seed_resume_point& point) { journal.record_partial(id, point); };
+        hooks.get_resume_point = [&](size_t id) { return journal.resume_point(id); };
+        hooks.checkpoint_seconds = 60;
+
+        //A stop leaves a checkpoint at the next subtree of every seed in progress, well before either is done
+        std::thread stopper;
+        if (stop_early)
+        {
+            stopper = std::thread([&]() {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                pool.request_stop();
+            });
+        }
+
+        stack_allocator allocator;
+        pool.expand_seeds(allocator, n, seeds, seed_ids, nullptr, hooks);
+        if (stopper.joinable())
+        {
+            stopper.join();
+        }
+        REQUIRE(pool.was_stopped() == stop_early);
+
+        journal.close();
+        pool.shutdown();
+        return journal.total();
+    };
+
+    size_t num_partial = 0;
+    run(true, false, num_partial);
+
+    output_t total = run(false, true, num_partial);
+    REQUIRE(num_partial > 0);
+    REQUIRE(total == 346543LLu);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("CHECK THAT parallel seed generation matches dfs order")
+{
+    stack_allocator allocator;
+    std::vector<polycube_seed> expected = generate_seeds(allocator, 8);
+
+    polycubes_thread_pool pool;
+    pool.init(3);
+    std::vector<polycube_seed> seeds = pool.generate_seeds_parallel(allocator, 8);
+    pool.shutdown();
+
+    REQUIRE(seeds.size() == expected.size());
+    REQUIRE(memcmp(seeds.data(), expected.data(), seeds.size() * sizeof(polycube_seed)) == 0);
+}
+
+TEST_CASE("CHECK THAT shard results merge only when every seed is present once")
+{
+    stack_allocator allocator;
+    std::vector<polycube_seed> seeds = generate_seeds(allocator, 5);
+
+    polycubes_thread_pool pool;
+    pool.init(2);
+
+    std::vector<std::string> paths;
+    for (size_t shard = 0; shard < 3; shard++)
+    {
+        std::vector<size_t> seed_ids = select_shard_seeds(seeds.size(), shard, 3);
+        std::vector<output_t> seed_counts;
+        pool.expand_seeds(allocator, 8, seeds, seed_ids, &seed_counts);
+
+        std::vector<seed_result> results;
+        for (size_t id : seed_ids)
+        {
+            results.push_back({ id, seed_counts[id] });
+        }
+
+        paths.push_back("test_shard_" + std::to_string(shard) + ".txt");
+        REQUIRE(write_seed_results(paths.back(), { 8, 5, seeds.size(), hash_seeds(seeds), shard, 3 }, results));
+    }
+    pool.shutdown();
+
+    seed_results_header header;
+    size_t total;
+    REQUIRE(merge_seed_results(paths, header, total));
+    REQUIRE(total == 6922LLu);
+
+    REQUIRE_FALSE(merge_seed_results({ paths[0], paths[1] }, header, total));
+    REQUIRE_FALSE(merge_seed_results({ paths[0], paths[1], paths[2], paths[1] }, header, total));
+
+    for (const std::string& path : paths)
+    {
+        std::remove(path.c_str());
+    }
+}
+
+TEST_CASE("CHECK THAT a seed journal reloads what was recorded, and drops a torn last line")
+{
+    const std::string path = "test_seed_journal.txt";
+    std::remove(path.c_str());
+    seed_results_header header = { 9, 5, 10, 0x1234, 0, 1 };
+
+    scope {
+        seed_journal journal;
+        REQUIRE(journal.open(path, header, false));
+        journal.record(2, 100);
+        journal.record(7, 250);
+        journal.record_partial(4, { 30, { 3, 5, 9 } });
+    }
+
+    //Starting again would throw away the seeds already finished
+    scope {
+        seed_journal journal;
+        REQUIRE_FALSE(journal.open(path, header, false));
+    }
+
+    //A crash mid write leaves the last line without its newline
+    FILE* file = fopen(path.c_str(), "a");
+    REQUIRE(file != nullptr);
+    fprintf(file, "5 1");
+    fclose(file);
+
+    scope {
+        seed_journal journal;
+        REQUIRE(journal.open(path, header, true));
+        REQUIRE(journal.num_done() == 2);
+        REQUIRE(journal.is_done(2));
+        REQUIRE(journal.is_done(7));
+        REQUIRE(!journal.is_done(5));
+        REQUIRE(journal.count(7) == 250);
+        REQUIRE(journal.total() == 350);
+        REQUIRE(journal.resume_point(4) != nullptr);
+        REQUIRE(journal.resume_point(4)->partial_count == 30);
+        REQUIRE(journal.resume_point(4)->labels == std::vector<uint8_t>{ 3, 5, 9 });
+
+        //Appends after a resume follow a whole line
+        journal.record(5, 12);
+    }
+
+    scope {
+        seed_journal journal;
+        REQUIRE(journal.open(path, header, true));
+        REQUIRE(journal.num_done() == 3);
+        REQUIRE(journal.count(5) == 12);
+        REQUIRE(journal.total() == 362);
+    }
+
+    seed_results_header other = header;
+    other.n = 10;
+    scope {
+        seed_journal journal;
+        REQUIRE_FALSE(journal.open(path, other, true));
+    }
+
+    std::remove(path.c_str());
+}
+
+#ifndef _WIN32
+
+TEST_CASE("CHECK THAT the coordinator hands out every seed, reassigns a dropped worker's, and resumes from its journal")
+{
+    const std::string path = "test_coordinator.journal";
+    const std::string ledger_path = "test_coordinator_ledger.txt";
+    std::remove(path.c_str());
+
+    stack_allocator allocator;
+    std::vector<polycube_seed> seeds = generate_seeds(allocator, 5);
+
+    auto seed_count = [&](size_t id) {
+        stack_marker marker(allocator);
+        return expand_polycubes_dfs_from_current(allocator, 8, 8, *build_rooted_from_seed(allocator, seeds[id]), [](auto&&) {}, [](auto&&) {});
+    };
+
+    //Workers are played by this thread, over socketpairs, with the coordinator polled after each message
+    auto connect = [](seed_coordinator& coordinator) {
+        int fds[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        coordinator.add_client(fds[0]);
+
+        socket_line_reader worker{ fds[1] };
+        std::string line;
+        REQUIRE(worker.read_line(line));
+        REQUIRE(line.rfind("SEARCH 8 5 ", 0) == 0);
+        REQUIRE(send_line(worker.fd, "HELLO"));
+        coordinator.poll_once(-1, 1000);
+        return worker;
+    };
+
+    auto send = [](seed_coordinator& coordinator, socket_line_reader& worker, const std::string& message) {
+        REQUIRE(send_line(worker.fd, message));
+        coordinator.poll_once(-1, 1000);
+    };
+
+    auto request = [&](seed_coordinator& coordinator, socket_line_reader& worker) {
+        send(coordinator, worker, "WORK");
+        std::string line;
+        REQUIRE(worker.read_line(line));
+
+        std::istringstream message(line);
+        std::string type;
+        size_t k = 0, id;
+        message >> type >> k;
+        std::vector<size_t> batch;
+        while (batch.size() < k && message >> id)
+        {
+            batch.push_back(id);
+        }
+        REQUIRE((type == "DONE" || type == "SEEDS"));
+        return batch;
+    };
+
+    size_t done_before_crash = 0;
+    scope {
+        seed_coordinator coordinator;
+        REQUIRE(coordinator.start(8, 5, 0, path, false));
+
+        socket_line_reader first = connect(coordinator);
+        socket_line_reader second = connect(coordinator);
+        REQUIRE(coordinator.num_clients() == 2);
+
+        std::vector<size_t> first_batch = request(coordinator, first);
+        REQUIRE(first_batch.size() > 1);
+
+        //The first worker finishes one seed then drops, so the rest of its batch is handed out again, ahead of the seeds never handed out
+        send(coordinator, first, "RESULT " + std::to_string(first_batch[0]) + " " + std::to_string(seed_count(first_batch[0])));
+        close(first.fd);
+        coordinator.poll_once(-1, 1000);
+        REQUIRE(coordinator.num_clients() == 1);
+        REQUIRE(coordinator.num_done() == 1);
+
+        std::vector<size_t> second_batch = request(coordinator, second);
+        for (size_t i = 1; i < first_batch.size(); i++)
+        {
+            REQUIRE(std::find(second_batch.begin(), second_batch.end(), first_batch[i]) != second_batch.end());
+        }
+
+        for (size_t i = 0; i < second_batch.size() / 2; i++)
+        {
+            send(coordinator, second, "RESULT " + std::to_string(second_batch[i]) + " " + std::to_string(seed_count(second_batch[i])));
+        }
+        done_before_crash = coordinator.num_done();
+        REQUIRE(done_before_crash == 1 + second_batch.size() / 2);
+
+        //A result for a seed the worker doesn't hold gets it dropped, then the coordinator goes down with results still out
+        send(coordinator, second, "RESULT " + std::to_string(first_batch[0]) + " 1");
+        REQUIRE(coordinator.num_clients() == 0);
+        close(second.fd);
+    }
+
+    //A restarted coordinator keeps every result it had, and hands out the rest
+    seed_coordinator coordinator;
+    REQUIRE(coordinator.start(8, 5, 0, path, true));
+    REQUIRE(coordinator.num_done() == done_before_crash);
+
+    socket_line_reader worker = connect(coordinator);
+    size_t handed_out = 0;
+    std::vector<size_t> batch;
+    while (!(batch = request(coordinator, worker)).empty())
+    {
+        for (size_t id : batch)
+        {
+            send(coordinator, worker, "RESULT " + std::to_string(id) + " " + std::to_string(seed_count(id)));
+        }
+        handed_out += batch.size();
+    }
+    close(worker.fd);
+
+    REQUIRE(coordinator.finished());
+    REQUIRE(handed_out == seeds.size() - done_before_crash);
+    REQUIRE(coordinator.total() == 6922LLu);
+
+    REQUIRE(coordinator.write_ledger(ledger_path));
+    seed_results_header header;
+    size_t total;
+    REQUIRE(merge_seed_results({ ledger_path }, header, total));
+    REQUIRE(total == 6922LLu);
+
+    std::remove(path.c_str());
+    std::remove(ledger_path.c_str());
+}
+
+#endif
+
+TEST_CASE("CHECK THAT progress lines give the right durations and percent and ETA")
+{
+    char text[256];
+    format_duration(0.0, text, sizeof(text));
+    REQUIRE(std::string(text) == "0s");
+    format_duration(59.4, text, sizeof(text));
+    REQUIRE(std::string(text) == "59s");
+    format_duration(59.6, text, sizeof(text));
+    REQUIRE(std::string(text) == "1m00s");
+    format_duration(3599.6, text, sizeof(text));
+    REQUIRE(std::string(text) == "1h00m00s");
+    format_duration(90061.0, text, sizeof(text));
+    REQUIRE(std::string(text) == "25h01m01s");
+
+    //A quarter of the estimated cost done in 10 minutes leaves 30 minutes
+    format_progress_line({ 3, 10, 25, 100, 1000 }, 600.0, 5.0, 600, text, sizeof(text));
+    REQUIRE(std::string(text) == "Progress: 3/10 seeds (25.0% of estimated cost), found 1000, 120 polycubes/s (1.67 overall), elapsed 10m00s, ETA 30m00s");
+
+    //...and in 50 minutes leaves two and a half hours
+    format_progress_line({ 3, 10, 25, 100, 1000 }, 3000.0, 5.0, 600, text, sizeof(text));
+    REQUIRE(std::string(text).find("elapsed 50m00s, ETA 2h30m00s") != std::string::npos);
+
+    //Nothing done yet has no rate to extrapolate
+    format_progress_line({ 0, 10, 0, 100, 0 }, 30.0, 30.0, 0, text, sizeof(text));
+    REQUIRE(std::string(text) == "Progress: 0/10 seeds (0.0% of estimated cost), found 0, 0 polycubes/s (0 overall), elapsed 30s, ETA unknown");
+
+    //The job queue knows neither the seed total nor their costs
+    format_progress_line({ 5, 0, 0, 0, 1000 }, 10.0, 10.0, 1000, text, sizeof(text));
+    REQUIRE(std::string(text) == "Progress: 5 seeds, found 1000, 100 polycubes/s (100 overall), elapsed 10s, ETA unknown");
+}
+
+TEST_CASE("CHECK THAT affinity policies place workers on the right nodes")
+{
+    std::vector<cpu_info> topology = { { 0, 0 }, { 1, 0 }, { 2, 1 }, { 3, 1 } };
+
+    std::vector<cpu_info> compact = plan_worker_cpus(affinity_policy::Compact, {}, topology, 3);
+    REQUIRE(compact[0].cpu == 0);
+    REQUIRE(compact[1].cpu == 1);
+    REQUIRE(compact[2].cpu == 2);
+
+    std::vector<cpu_info> scatter = plan_worker_cpus(affinity_policy::Scatter, {}, topology, 5);
+    REQUIRE(scatter[0].node == 0);
+    REQUIRE(scatter[1].node == 1);
+    REQUIRE(scatter[2].cpu == 1);
+    REQUIRE(scatter[3].cpu == 3);
+    REQUIRE(scatter[4].cpu == 0);
+
+    std::vector<int> cpus;
+    REQUIRE(parse_cpu_list("3,0-1", cpus));
+    std::vector<cpu_info> list = plan_worker_cpus(affinity_policy::List, cpus, topology, 3);
+    REQUIRE(list[0].cpu == 3);
+    REQUIRE(list[0].node == 1);
+    REQUIRE(list[2].cpu == 1);
+
+    REQUIRE(plan_worker_cpus(affinity_policy::None, {}, topology, 2)[1].cpu == -1);
+}
+
+#ifdef POLYCUBES_COROUTINES
+
+TEST_CASE("CHECK THAT the coroutine dfs counts the same as the recursive dfs")
+{
+    stack_allocator allocator;
+    coroutine_frame_arena arena;
+    rooted_polycube* base = allocator.allocate();
+    init_single_cube(*base);
+
+    for (int n = 3; n <= 8; n++)
+    {
+        dfs_generator search = expand_polycubes_coroutine(arena, allocator, n, n, *base);
+        REQUIRE(!search.next());
+        REQUIRE(search.count() == expand_polycubes_dfs(allocator, n, n, [](auto&&) {}, [](auto&&) {}));
+    }
+    REQUIRE(arena.bytes_used() == 0);
+}
+
+TEST_CASE("CHECK THAT the coroutine arena grows by chunks, and fails a search it can't fit")
+{
+    stack_allocator allocator;
+    rooted_polycube* base = allocator.allocate();
+    init_single_cube(*base);
+
+    //The deepest the frames go, suspended at each polycube of size 7
+    size_t peak = 0;
+    scope {
+        coroutine_frame_arena arena;
+        dfs_generator search = expand_polycubes_coroutine(arena, allocator, 8, 7, *base);
+        while (search.next())
+        {
+            peak = std::max(peak, arena.bytes_used());
+        }
+        REQUIRE(!search.failed());
+    }
+    REQUIRE(peak > 0);
+
+    //Chunks too small for the whole search are chained
+    coroutine_frame_arena chained(peak / 2);
+    scope {
+        dfs_generator search = expand_polycubes_coroutine(chained, allocator, 8, 8, *base);
+        REQUIRE(!search.next());
+        REQUIRE(!search.failed());
+        REQUIRE(search.count() == 6922LLu);
+    }
+    REQUIRE(chained.chunks() > 1);
+    REQUIRE(chained.bytes_used() == 0);
+
+    //Without room to chain them, the search fails rather than counting without the levels it couldn't fit
+    coroutine_frame_arena capped(peak / 2, 1);
+    scope {
+        dfs_generator search = expand_polycubes_coroutine(capped, allocator, 8, 8, *base);
+        REQUIRE(search.valid());
+        REQUIRE(!search.next());
+        REQUIRE(search.failed());
+        REQUIRE(search.count() == 0);
+        REQUIRE(!search.next());
+    }
+    REQUIRE(capped.bytes_used() == 0);
+}
+
+TEST_CASE("CHECK THAT interleaved coroutine searches give the same counts")
+{
+    stack_allocator allocator;
+    std::vector<polycube_seed> seeds = generate_seeds(allocator, 4);
+
+    //Round robin between a search per seed, suspending each at every polycube of size 6, which is left for the caller to expand
+    std::vector<std::unique_ptr<suspendable_search>> searches;
+    for (const polycube_seed& seed : seeds)
+    {
+        stack_marker marker(allocator);
+        searches.emplace_back(new suspendable_search());
+        REQUIRE(searches.back()->start(*build_rooted_from_seed(allocator, seed), 8, 6));
+    }
+
+    size_t yields = 0;
+    uint64_t total = 0;
+    bool running = true;
+    while (running)
+    {
+        running = false;
+        for (auto& search : searches)
+        {
+            if (search->next())
+            {
+                //Each subtree suspended on is handed off, here to the recursive dfs
+                REQUIRE(search->current().k == 6);
+                total += expand_polycubes_dfs_from_current(allocator, 8, 8, search->current(), [](auto&&) {}, [](auto&&) {});
+                yields++;
+                running = true;
+            }
+        }
+    }
+
+    for (auto& search : searches)
+    {
+        REQUIRE(search->count() == 0);
+    }
+
+    size_t expected_yields = 0;
+    expand_polycubes_dfs(allocator, 8, 6, [](auto&&) {}, [&](auto&&) { expected_yields++; });
+
+    REQUIRE(yields == expected_yields);
+    REQUIRE(total == 6922LLu);
+}
+
+#endif
+
+TEST_CASE("CHECK THAT the stack allocator grows without moving frames")
+{
+    stack_allocator_typed<int, 4> allocator;
+    std::vector<int*> frames;
+
+    for (int i = 0; i < 10; i++)
+    {
+        frames.push_back(allocator.allocate());
+        *frames.back() = i;
+    }
+    REQUIRE(allocator.capacity() == 12);
+
+    //Frames from earlier chunks are untouched by growing
+    for (int i = 0; i < 10; i++)
+    {
+        REQUIRE(*frames[i] == i);
+    }
+
+    //Releasing through a marker reuses the same frames, without growing again
+    allocator.set_marker(2);
+    scope {
+        stack_marker_typed<int, 4> marker(allocator);
+        REQUIRE(allocator.allocate() == frames[2]);
+        REQUIRE(allocator.allocate() == frames[3]);
+        REQUIRE(allocator.allocate() == frames[4]);
+    }
+    REQUIRE(allocator.get_marker() == 2);
+    REQUIRE(allocator.capacity() == 12);
+}
+
+TEST_CASE("CHECK THAT huge page backed stacks count the same")
+{
+    huge_page_setting().store(huge_page_mode::Transparent);
+
+    //Huge page sized mappings start on a huge page boundary, or fall back to the heap where mmap isn't available
+    page_buffer small(100);
+    page_buffer buffer(HUGE_PAGE_SIZE);
+    REQUIRE(small.data() != nullptr);
+    REQUIRE(buffer.data() != nullptr);
+    if (buffer.is_mapped())
+    {
+        REQUIRE((uintptr_t)buffer.data() % HUGE_PAGE_SIZE == 0);
+    }
+
+    //Stack chunks fill whole huge pages, wasting less than a frame of each
+    size_t frames = huge_page_elements(sizeof(rooted_polycube), 32);
+    REQUIRE(frames >= 32);
+    size_t pages = (frames * sizeof(rooted_polycube) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+    REQUIRE((frames + 1) * sizeof(rooted_polycube) > pages * HUGE_PAGE_SIZE);
+
+    stack_allocator allocator;
+    uint64_t result = expand_polycubes_dfs(allocator, 8, 8, [](auto&&) {}, [](auto&&) {});
+    REQUIRE(allocator.capacity() == frames);
+
+    huge_page_setting().store(huge_page_mode::Off);
+    REQUIRE(result == 6922);
+    REQUIRE(huge_page_elements(sizeof(rooted_polycube), 32) == 32);
+}
+
+TEST_CASE("CHECK THAT worker states keep counters and allocators on separate cache lines")
+{
+    aligned_ptr<worker_state> state = make_aligned<worker_state>();
+
+    REQUIRE((uintptr_t)state.get() % FALSE_SHARING_SIZE == 0);
+    REQUIRE((uintptr_t)&state->allocator - (uintptr_t)&state->counters >= FALSE_SHARING_SIZE);
+    REQUIRE(sizeof(worker_state) % FALSE_SHARING_SIZE == 0);
+}
+
+TEST_CASE("CHECK THAT the job pool hands each slot to one thread at a time")
+{
+    job_pool<int> pool;
+    pool.init(8);
+
+    std::vector<int*> taken;
+    while (int* slot = pool.acquire())
+    {
+        taken.push_back(slot);
+    }
+    REQUIRE(taken.size() == 8);
+
+    for (int* slot : taken)
+    {
+        pool.release(slot);
+    }
+
+    //Each thread marks the slots it holds, so a slot handed out twice at once would be seen
+    std::atomic<bool> shared_slot{ false };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 20000; i++)
+            {
+                int* slot = pool.acquire();
+                if (!slot)
+                {
+                    continue;
+                }
+                *slot = t;
+                std::this_thread::yield();
+                if (*slot != t)
+                {
+                    shared_slot = true;
+                }
+                pool.release(slot);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    REQUIRE(!shared_slot);
+}
+
+TEST_CASE("CHECK THAT leaf views materialize each polycube once, in canonical form")
+{
+    stack_allocator allocator;
+    std::set<std::string> shapes;
+    bool all_canonical = true;
+
+    size_t count = expand_polycubes_dfs(allocator, 7, 7, [&](const leaf_view& leaf) {
+        polycube_sparse_small pc;
+        leaf.materialize(pc);
+        all_canonical = all_canonical && is_polycube_canonical_sparse(pc, 7);
+
+        //Dimensions, then the cells in order, as the hex encoding alone can be ambiguous
+        std::vector<int> cells;
+        pc.for_each_cube([&](const packed_position& cube, size_t) {
+            cells.push_back((cube.z * pc.dim.y + cube.y) * pc.dim.x + cube.x);
+        });
+        std::sort(cells.begin(), cells.end());
+
+        std::string key = std::to_string(pc.dim.x) + "x" + std::to_string(pc.dim.y) + "x" + std::to_string(pc.dim.z);
+        for (int cell : cells)
+        {
+            key += " " + std::to_string(cell);
+        }
+        shapes.insert(key);
+    }, [](auto&&) {});
+
+    REQUIRE(count == 1023);
+    REQUIRE(shapes.size() == 1023);
+    REQUIRE(all_canonical);
+
+    //The rotation generators keep a reference to the polycube they rotate, so they mustn't take a temporary
+    static_assert(!std::is_constructible<all_rotations_generator_sparse<MAX_POLYCUBE_CUBES>, polycube_sparse&&>::value, "generator would dangle");
+    static_assert(!std::is_constructible<all_180_rotations_generator_sparse<MAX_POLYCUBE_CUBES>, polycube_sparse&&>::value, "generator would dangle");
+    static_assert(std::is_constructible<all_rotations_generator_sparse<MAX_POLYCUBE_CUBES>, const polycube_sparse&>::value, "generator takes an lvalue");
+}
+
+TEST_CASE("CHECK THAT the queue moves elements through in order, including move only ones")
+{
+    thread_safe_queue<std::unique_ptr<int>> queue(4);
+
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            REQUIRE(queue.try_enqueue(std::unique_ptr<int>(new int(i))));
+        }
+        REQUIRE(!queue.try_enqueue(std::unique_ptr<int>(new int(4))));
+        REQUIRE(queue.size() == 4);
+
+        for (int i = 0; i < 4; i++)
+        {
+            std::unique_ptr<int> value;
+            REQUIRE(queue.dequeue(value));
+            REQUIRE(*value == i);
+        }
+
+        std::unique_ptr<int> empty;
+        REQUIRE(!queue.dequeue(empty));
+    }
+}
+
+TEST_CASE("CHECK THAT bulk enqueue and dequeue keep order across the bound")
+{
+    thread_safe_queue<int> queue(4);
+    std::vector<int> values(20);
+    for (int i = 0; i < 20; i++)
+    {
+        values[i] = i;
+    }
+
+    //More than the bound, so the producer waits part way for the consumer to make room
+    std::thread producer([&]() { queue.enqueue_bulk(values.begin(), values.end()); });
+
+    std::vector<int> received;
+    while (received.size() < values.size())
+    {
+        int batch[3];
+        size_t count = queue.try_dequeue_bulk(batch, 3);
+        REQUIRE(count <= 3);
+        received.insert(received.end(), batch, batch + count);
+        std::this_thread::yield();
+    }
+    producer.join();
+
+    REQUIRE(received == values);
+    REQUIRE(queue.size() == 0);
+}
+
+TEST_CASE("CHECK THAT grid cells hold every label the largest n can write")
+{
+    REQUIRE(MAX_LABEL == max_label_for(MAX_POLYCUBE_CUBES));
+    REQUIRE(MAX_LABEL < (int)FILLED_CUBE);
+
+    //The highest labels round trip through a cell, and stay apart from a filled cube
+    stack_allocator allocator;
+    rooted_polycube* single = allocator.allocate();
+    init_single_cube(*single);
+    rooted_polycube* pc = prepare_children(allocator, *single);
+
+    pc->set_cube(0, 0, 0, MAX_LABEL);
+    pc->set_cube(1, 0, 0, MAX_LABEL - 1);
+    REQUIRE(pc->get_cube(0, 0, 0) == MAX_LABEL);
+    REQUIRE(pc->get_cube(1, 0, 0) == MAX_LABEL - 1);
+    REQUIRE(pc->get_cube(0, 0, 0) != FILLED_CUBE);
+
+    //Every frame a search expands stays within the bound for its size
+    int highest_written = 0;
+    expand_polycubes_dfs(allocator, 9, 8, [](auto&&) {}, [&](const rooted_polycube& frame) {
+        highest_written = std::max(highest_written, frame.highest_written);
+    });
+    REQUIRE(highest_written > max_label_for(7));
+    REQUIRE(highest_written <= max_label_for(8));
+
+    //n above the limit is refused rather than overrunning the cube stacks and labels
+    REQUIRE(check_polycube_size(MAX_POLYCUBE_CUBES));
+    REQUIRE_FALSE(check_polycube_size(MAX_POLYCUBE_CUBES + 1));
+    REQUIRE(expand_polycubes_dfs(allocator, MAX_POLYCUBE_CUBES + 1, MAX_POLYCUBE_CUBES + 1, [](auto&&) {}, [](auto&&) {}) == 0);
+}
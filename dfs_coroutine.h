@@ -0,0 +1,487 @@
+#pragma once
+
+//////////////////////////////////////////////////
+// Suspendable dfs, as C++20 coroutines. Opt in with the POLYCUBES_COROUTINES cmake option
+//////////////////////////////////////////////////
+
+#ifdef POLYCUBES_COROUTINES
+
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "cubes.h"
+
+//Coroutine frames are placed on 16 byte boundaries, the most any frame here needs
+const size_t COROUTINE_FRAME_ALIGNMENT = 16;
+
+//Size of each chunk of coroutine frames, room for a frame per level of the deepest search, with plenty to spare
+const size_t COROUTINE_ARENA_CHUNK_SIZE = 64 * 1024;
+
+/// <summary>
+/// Stack of coroutine frames, in the same spirit as stack_allocator - frames are bumped off the top,
+/// and must be freed in reverse order, which nested dfs levels always are
+/// Grows by chaining chunks as they're needed, so frames never move, and keeps them once freed
+/// </summary>
+class coroutine_frame_arena
+{
+public:
+
+    inline coroutine_frame_arena(size_t chunk_size = COROUTINE_ARENA_CHUNK_SIZE, size_t max_chunks = MAX_STACK_CHUNKS)
+        : m_chunk_size(chunk_size), m_max_chunks(max_chunks), m_chunk(0), m_top(0)
+    {
+        m_chunks.emplace_back(new uint8_t[chunk_size]);
+    }
+
+    /// <summary>
+    /// Allocates a frame of size bytes, or returns nullptr if it's bigger than a chunk, or max_chunks are full
+    /// Each frame is preceded by a header pointing back at the arena, so frames can be freed knowing only their address
+    /// </summary>
+    /// <param name="size"></param>
+    /// <returns></returns>
+    inline void* allocate(size_t size)
+    {
+        size_t total = round_up(sizeof(frame_header) + size);
+        if (total > m_chunk_size)
+        {
+            return nullptr;
+        }
+
+        size_t chunk = m_chunk;
+        size_t top = m_top;
+        if (m_chunk_size - top < total)
+        {
+            //Frames don't span chunks, the rest of this one is left until the frames after it are freed
+            chunk++;
+            top = 0;
+            if (chunk == m_chunks.size())
+            {
+                if (m_chunks.size() >= m_max_chunks)
+                {
+                    return nullptr;
+                }
+                m_chunks.emplace_back(new uint8_t[m_chunk_size]);
+            }
+        }
+
+        frame_header* header = (frame_header*)&m_chunks[chunk][top];
+        header->arena = this;
+        header->previous_chunk = m_chunk;
+        header->previous_top = m_top;
+        m_chunk = chunk;
+        m_top = top + total;
+
+        return header + 1;
+    }
+
+    /// <summary>
+    /// Frees a frame of size bytes allocated from any arena, which must be the most recent one still allocated from it
+    /// </summary>
+    /// <param name="frame"></param>
+    /// <param name="size"></param>
+    static inline void free(void* frame, size_t size)
+    {
+        frame_header* header = (frame_header*)frame - 1;
+        coroutine_frame_arena* arena = header->arena;
+
+        if ((uint8_t*)header + round_up(sizeof(frame_header) + size) != &arena->m_chunks[arena->m_chunk][arena->m_top])
+        {
+            printf("Error! coroutine frames freed out of order\n");
+        }
+        arena->m_chunk = header->previous_chunk;
+        arena->m_top = header->previous_top;
+    }
+
+    /// <summary>
+    /// Bytes from the start of the arena to the top of the last frame, including any left unused at the end of full chunks
+    /// </summary>
+    inline size_t bytes_used() const
+    {
+        return m_chunk * m_chunk_size + m_top;
+    }
+
+    /// <summary>
+    /// Number of chunks the arena has grown to
+    /// </summary>
+    inline size_t chunks() const
+    {
+        return m_chunks.size();
+    }
+
+private:
+
+    struct alignas(COROUTINE_FRAME_ALIGNMENT) frame_header
+    {
+        coroutine_frame_arena* arena;
+        size_t previous_chunk;
+        size_t previous_top;
+    };
+
+    static inline size_t round_up(size_t size)
+    {
+        return (size + COROUTINE_FRAME_ALIGNMENT - 1) & ~(COROUTINE_FRAME_ALIGNMENT - 1);
+    }
+
+    size_t m_chunk_size;
+    size_t m_max_chunks;
+    size_t m_chunk; //Chunk the top frame is in
+    size_t m_top; //Offset of the top, within that chunk
+    std::vector<std::unique_ptr<uint8_t[]>> m_chunks;
+};
+
+/// <summary>
+/// A recursive generator - a level of the dfs that yields the rooted polycubes it reaches of size m,
+/// and co_returns the number of polycubes of size n it counted
+/// Nested levels are co_awaited, and their yields go straight to whoever is driving the outermost level,
+/// which resumes the innermost level directly, so suspending and resuming costs the same at any depth
+/// </summary>
+class dfs_generator
+{
+public:
+
+    struct promise_type
+    {
+        rooted_polycube* value = nullptr; //Last polycube yielded, on the outermost level
+        size_t count = 0;
+        promise_type* root = this;
+        std::coroutine_handle<promise_type> parent;
+        std::coroutine_handle<promise_type> leaf; //Innermost running level, on the outermost level
+        bool failed = false; //Set on the outermost level if a nested level's frame couldn't be allocated, abandoning the search
+
+        template<typename... Args>
+        static void* operator new(size_t size, coroutine_frame_arena& arena, Args&&...) noexcept
+        {
+            return arena.allocate(size);
+        }
+
+        static void operator delete(void* frame, size_t size)
+        {
+            coroutine_frame_arena::free(frame, size);
+        }
+
+        static dfs_generator get_return_object_on_allocation_failure()
+        {
+            return dfs_generator(nullptr);
+        }
+
+        dfs_generator get_return_object()
+        {
+            return dfs_generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        struct final_awaiter
+        {
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                //A finished nested level hands control back to the level that awaited it
+                promise_type& promise = handle.promise();
+                if (promise.parent)
+                {
+                    promise.root->leaf = promise.parent;
+                    return promise.parent;
+                }
+                return std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always yield_value(rooted_polycube& pc) noexcept
+        {
+            root->value = &pc;
+            return {};
+        }
+
+        /// <summary>
+        /// Runs a nested level to completion, passing its yields through, and gives back its count
+        /// If the nested level couldn't be made, the search is marked failed and suspended for good, rather than counting without it
+        /// </summary>
+        struct nested_awaiter
+        {
+            std::coroutine_handle<promise_type> child;
+
+            bool await_ready() noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                if (!child)
+                {
+                    printf("Error! coroutine frame arena is full, the search is abandoned\n");
+                    handle.promise().root->failed = true;
+                    return std::noop_coroutine();
+                }
+
+                promise_type& child_promise = child.promise();
+                child_promise.parent = handle;
+                child_promise.root = handle.promise().root;
+                child_promise.root->leaf = child;
+                return child;
+            }
+
+            size_t await_resume() noexcept
+            {
+                return child.promise().count;
+            }
+        };
+
+        nested_awaiter await_transform(dfs_generator&& nested) noexcept
+        {
+            return nested_awaiter{ nested.m_handle };
+        }
+
+        void return_value(size_t result) noexcept
+        {
+            count = result;
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    dfs_generator(dfs_generator&& other) noexcept : m_handle(other.m_handle)
+    {
+        other.m_handle = nullptr;
+    }
+
+    dfs_generator& operator=(dfs_generator&& other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+
+    dfs_generator(const dfs_generator&) = delete;
+    dfs_generator& operator=(const dfs_generator&) = delete;
+
+    ~dfs_generator()
+    {
+        destroy();
+    }
+
+    /// <summary>
+    /// False if the frame couldn't be allocated
+    /// </summary>
+    inline bool valid() const
+    {
+        return (bool)m_handle;
+    }
+
+    /// <summary>
+    /// Runs the search until it reaches the next polycube of size m, returns false once it's finished, or has failed, instead
+    /// </summary>
+    /// <returns></returns>
+    inline bool next()
+    {
+        if (!m_handle || m_handle.done() || m_handle.promise().failed)
+        {
+            return false;
+        }
+
+        promise_type& promise = m_handle.promise();
+        promise.value = nullptr;
+        (promise.leaf ? promise.leaf : m_handle).resume();
+        return !m_handle.done() && !promise.failed;
+    }
+
+    /// <summary>
+    /// The polycube of size m last reached. It's the search's own frame, so only valid until the next call to next()
+    /// </summary>
+    inline rooted_polycube& current() const
+    {
+        return *m_handle.promise().value;
+    }
+
+    /// <summary>
+    /// Number of polycubes of size n counted, once next() has returned false. 0 if the search failed, which isn't a count
+    /// </summary>
+    inline size_t count() const
+    {
+        return m_handle && !m_handle.promise().failed ? m_handle.promise().count : 0;
+    }
+
+    /// <summary>
+    /// True if the search was abandoned as the arena ran out of room for a level, so its count is incomplete
+    /// </summary>
+    inline bool failed() const
+    {
+        return m_handle && m_handle.promise().failed;
+    }
+
+private:
+
+    explicit dfs_generator(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+    {
+    }
+
+    //Nested levels are destroyed by their awaiting level as soon as they finish, so frames are always freed in order
+    inline void destroy()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+/// <summary>
+/// Coroutine version of expand_polycubes_dfs_from_current. Counts the polycubes of size n from current, and yields
+/// each rooted polycube of size m instead of calling on_expanded, so the caller can suspend the search there
+/// Coroutine frames come from arena, and rooted polycube frames from allocator, so a search suspended on one thread can be
+/// resumed on another, as long as the arena and allocator go with it
+/// </summary>
+/// <param name="arena"></param>
+/// <param name="allocator"></param>
+/// <param name="n"></param>
+/// <param name="m"></param>
+/// <param name="current"></param>
+/// <returns></returns>
+inline dfs_generator expand_polycubes_coroutine(coroutine_frame_arena& arena, stack_allocator& allocator, int n, int m, rooted_polycube& current)
+{
+    stack_marker marker(allocator);
+    rooted_polycube* cropped = prepare_children(allocator, current);
+
+    size_t count = 0;
+
+    //Same order as for_each_cube, which can't be used here as a lambda can't suspend its caller
+    int index = 0;
+    for (int z = 0; z < cropped->dim.z; z++)
+    {
+        for (int y = 0; y < cropped->dim.y; y++)
+        {
+            for (int x = 0; x < cropped->dim.x; x++, index++)
+            {
+                int cube = cropped->cubes[index];
+                if (cube == FILLED_CUBE || cube <= cropped->highest_numbering)
+                {
+                    continue;
+                }
+
+                //To go from rooted translation -> just translation, root must be on plane z = 0 and y = 0, and must be smallest x in that row
+                if (z < cropped->root.z
+                    || (z == cropped->root.z && y < cropped->root.y)
+                    || (z == cropped->root.z && y == cropped->root.y && x < cropped->root.x))
+                {
+                    continue;
+                }
+
+                push_cube(*cropped, x, y, z, cube);
+
+                if (cropped->k == n)
+                {
+                    if (count_leaf(*cropped, n, [](auto&&) {}))
+                    {
+                        count++;
+                    }
+                }
+                else if (cropped->k == m)
+                {
+                    co_yield *cropped;
+                }
+                else
+                {
+                    count += co_await expand_polycubes_coroutine(arena, allocator, n, m, *cropped);
+                }
+
+                pop_cube(*cropped);
+            }
+        }
+    }
+
+    co_return count;
+}
+
+/// <summary>
+/// A search that owns everything it runs on, so several can be interleaved on one thread, or one handed to another thread
+/// between calls to next(). Roughly a stack_allocator's worth of memory each
+/// </summary>
+class suspendable_search
+{
+public:
+
+    //Frames in flight point back into the search, so it stays where it was made
+    suspendable_search() = default;
+    suspendable_search(const suspendable_search&) = delete;
+    suspendable_search& operator=(const suspendable_search&) = delete;
+
+    /// <summary>
+    /// Starts a search of size n from base, suspending at each polycube of size m. base is copied, so needn't outlive the search
+    /// Returns false if base is already too big to search from
+    /// </summary>
+    /// <param name="base"></param>
+    /// <param name="n"></param>
+    /// <param name="m"></param>
+    /// <returns></returns>
+    bool start(const rooted_polycube& base, int n, int m)
+    {
+        m_generator = dfs_generator_none();
+        m_allocator.set_marker(0);
+
+        if (base.k >= n || base.k >= m)
+        {
+            return false;
+        }
+
+        m_base = m_allocator.allocate();
+        *m_base = base;
+        m_generator = expand_polycubes_coroutine(m_arena, m_allocator, n, m, *m_base);
+        return m_generator.valid();
+    }
+
+    inline bool next()
+    {
+        return m_generator.next();
+    }
+
+    inline rooted_polycube& current() const
+    {
+        return m_generator.current();
+    }
+
+    inline size_t count() const
+    {
+        return m_generator.count();
+    }
+
+    inline bool failed() const
+    {
+        return m_generator.failed();
+    }
+
+private:
+
+    static dfs_generator dfs_generator_none()
+    {
+        return dfs_generator::promise_type::get_return_object_on_allocation_failure();
+    }
+
+    //Declared before the generator, so its frames are freed before the memory they live in
+    coroutine_frame_arena m_arena;
+    stack_allocator m_allocator;
+    rooted_polycube* m_base = nullptr;
+    dfs_generator m_generator = dfs_generator_none();
+};
+
+#endif
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////
+// Optional huge page backing for large, hot allocations - the stack allocator chunks and seed arrays
+//////////////////////////////////////////////////
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/// <summary>
+/// How page_buffers are backed
+/// </summary>
+enum class huge_page_mode
+{
+    Off, //Ordinary heap memory
+    Transparent, //2 MB aligned anonymous mappings, advised as huge pages for the kernel to back when it can
+    Explicit //Mapped from the reserved huge page pool (MAP_HUGETLB), falling back to transparent if the pool is empty
+};
+
+/// <summary>
+/// Process wide huge page setting, read whenever a page_buffer is made. Set it before the pool starts its workers
+/// </summary>
+/// <returns></returns>
+inline std::atomic<huge_page_mode>& huge_page_setting()
+{
+    static std::atomic<huge_page_mode> mode{ huge_page_mode::Off };
+    return mode;
+}
+
+/// <summary>
+/// Parses a huge page option: "off", "thp" or "explicit"
+/// </summary>
+/// <param name="text"></param>
+/// <param name="out_mode"></param>
+/// <returns></returns>
+inline bool parse_huge_page_mode(const std::string& text, huge_page_mode& out_mode)
+{
+    if (text == "off")
+    {
+        out_mode = huge_page_mode::Off;
+    }
+    else if (text == "thp")
+    {
+        out_mode = huge_page_mode::Transparent;
+    }
+    else if (text == "explicit")
+    {
+        out_mode = huge_page_mode::Explicit;
+    }
+    else
+    {
+        printf("Error! huge pages must be off, thp or explicit, got '%s'\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Asks for an existing range of anonymous memory to be backed by transparent huge pages. Only the 2 MB aligned
+/// part of the range can be, so small ranges are left alone. Does nothing where madvise isn't available
+/// </summary>
+/// <param name="data"></param>
+/// <param name="bytes"></param>
+inline void advise_huge_pages(void* data, size_t bytes)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    uintptr_t begin = ((uintptr_t)data + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)data + bytes) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    if (end > begin)
+    {
+        madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+    }
+#else
+    (void)data;
+    (void)bytes;
+#endif
+}
+
+/// <summary>
+/// Advises a vector's storage as huge pages, if the huge page setting asks for them. Vectors can't be mapped from the
+/// huge page pool, so explicit is treated as transparent. Best done after reserving and before filling, so the pages
+/// are faulted in huge rather than collapsed later
+/// </summary>
+/// <typeparam name="T"></typeparam>
+/// <param name="values"></param>
+template<typename T>
+inline void advise_huge_pages(std::vector<T>& values)
+{
+    if (huge_page_setting().load(std::memory_order_relaxed) != huge_page_mode::Off && values.capacity() > 0)
+    {
+        advise_huge_pages(values.data(), values.capacity() * sizeof(T));
+    }
+}
+
+/// <summary>
+/// How many elements a buffer of them should hold to fill whole huge pages, if the huge page setting asks for them,
+/// and at least min_elements. Without huge pages, just min_elements
+/// </summary>
+/// <param name="element_bytes"></param>
+/// <param name="min_elements"></param>
+/// <returns></returns>
+inline size_t huge_page_elements(size_t element_bytes, size_t min_elements)
+{
+    if (huge_page_setting().load(std::memory_order_relaxed) == huge_page_mode::Off)
+    {
+        return min_elements;
+    }
+
+    size_t pages = (min_elements * element_bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE;
+    return pages * HUGE_PAGE_SIZE / element_bytes;
+}
+
+/// <summary>
+/// A block of memory backed as the huge page setting asks, when it was made. Falls back to ordinary heap memory
+/// if huge pages can't be had, reporting it once
+/// Explicit huge page buffers are whole huge pages, others are only rounded to ordinary pages, so small buffers
+/// don't each cost 2 MB - size buffers with huge_page_elements to make the most of the huge pages
+/// </summary>
+class page_buffer
+{
+public:
+
+    page_buffer() = default;
+
+    explicit page_buffer(size_t bytes)
+    {
+        allocate(bytes, huge_page_setting().load(std::memory_order_relaxed));
+    }
+
+    page_buffer(page_buffer&& other) noexcept
+        : m_data(other.m_data), m_mapped_bytes(other.m_mapped_bytes)
+    {
+        other.m_data = nullptr;
+        other.m_mapped_bytes = 0;
+    }
+
+    page_buffer& operator=(page_buffer&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            m_data = other.m_data;
+            m_mapped_bytes = other.m_mapped_bytes;
+            other.m_data = nullptr;
+            other.m_mapped_bytes = 0;
+        }
+        return *this;
+    }
+
+    page_buffer(const page_buffer&) = delete;
+    page_buffer& operator=(const page_buffer&) = delete;
+
+    ~page_buffer()
+    {
+        release();
+    }
+
+    inline void* data() const
+    {
+        return m_data;
+    }
+
+    /// <summary>
+    /// True if the memory is a mapping that huge pages were asked for, rather than the heap
+    /// </summary>
+    inline bool is_mapped() const
+    {
+        return m_mapped_bytes > 0;
+    }
+
+private:
+
+    static void report_fallback(const char* message)
+    {
+        static std::atomic<bool> reported{ false };
+        if (!reported.exchange(true))
+        {
+            printf("%s\n", message);
+        }
+    }
+
+    void allocate(size_t bytes, huge_page_mode mode)
+    {
+#ifdef __linux__
+#ifdef MAP_HUGETLB
+        if (mode == huge_page_mode::Explicit)
+        {
+            //Pages from the pool are all huge, so the mapping has to be whole huge pages
+            size_t rounded = round_up(bytes, HUGE_PAGE_SIZE);
+            void* mapped = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mapped != MAP_FAILED)
+            {
+                m_data = mapped;
+                m_mapped_bytes = rounded;
+                return;
+            }
+            report_fallback("Explicit huge pages unavailable (see /proc/sys/vm/nr_hugepages), using transparent huge pages");
+            mode = huge_page_mode::Transparent;
+        }
+#endif
+
+        if (mode != huge_page_mode::Off)
+        {
+            //Only rounded to ordinary pages - the kernel can back whatever whole huge pages the buffer covers, and it's
+            //up to the caller to size buffers to fill them rather than waste the rest of a huge page
+            size_t rounded = round_up(bytes, (size_t)sysconf(_SC_PAGESIZE));
+
+            //Buffers big enough to hold a huge page are over mapped by one, so they can start on a 2 MB boundary,
+            //and the rest trimmed
+            size_t alignment = rounded >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 0;
+            size_t padded = rounded + alignment;
+            void* mapped = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapped != MAP_FAILED)
+            {
+                uintptr_t start = (uintptr_t)mapped;
+                uintptr_t aligned = alignment > 0 ? round_up(start, HUGE_PAGE_SIZE) : start;
+                if (aligned > start)
+                {
+                    munmap(mapped, aligned - start);
+                }
+                if (start + padded > aligned + rounded)
+                {
+                    munmap((void*)(aligned + rounded), start + padded - (aligned + rounded));
+                }
+
+                m_data = (void*)aligned;
+                m_mapped_bytes = rounded;
+                advise_huge_pages(m_data, m_mapped_bytes);
+                return;
+            }
+            report_fallback("Huge page mappings unavailable, using ordinary memory");
+        }
+#else
+        if (mode != huge_page_mode::Off)
+        {
+            report_fallback("Huge pages are only supported on linux, using ordinary memory");
+        }
+#endif
+
+        m_data = ::operator new(bytes);
+        m_mapped_bytes = 0;
+    }
+
+    template<typename Int>
+    static inline Int round_up(Int value, size_t multiple)
+    {
+        return (Int)((value + multiple - 1) / multiple * multiple);
+    }
+
+    void release()
+    {
+        if (!m_data)
+        {
+            return;
+        }
+
+#ifdef __linux__
+        if (m_mapped_bytes > 0)
+        {
+            munmap(m_data, m_mapped_bytes);
+            m_data = nullptr;
+            return;
+        }
+#endif
+        ::operator delete(m_data);
+        m_data = nullptr;
+    }
+
+    void* m_data = nullptr;
+    size_t m_mapped_bytes = 0; //0 for heap memory
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "sync_primitives.h"
+
+/// <summary>
+/// A fixed number of T, recycled through a lock free free list, so job payloads can be handed between threads
+/// without a heap allocation or reference count per job
+/// Slots are never freed back to the heap, and a slot's contents are left as they were when it was released
+/// </summary>
+/// <typeparam name="T"></typeparam>
+template<typename T>
+class job_pool
+{
+public:
+
+    /// <summary>
+    /// Allocates capacity slots, all free. Not thread safe, call before the pool is shared
+    /// </summary>
+    /// <param name="capacity"></param>
+    void init(size_t capacity)
+    {
+        m_values = std::unique_ptr<T[]>(new T[capacity]);
+        m_next = std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[capacity]);
+        m_capacity = capacity;
+
+        for (size_t i = 0; i < capacity; i++)
+        {
+            m_next[i].store(i + 1 < capacity ? (uint32_t)(i + 1) : NO_SLOT, std::memory_order_relaxed);
+        }
+        m_head.value.store(pack(0, capacity > 0 ? 0 : NO_SLOT), std::memory_order_release);
+    }
+
+    /// <summary>
+    /// Takes a free slot, or returns nullptr if every slot is in use
+    /// </summary>
+    /// <returns></returns>
+    inline T* acquire()
+    {
+        uint64_t head = m_head.value.load(std::memory_order_acquire);
+        while (true)
+        {
+            uint32_t index = (uint32_t)head;
+            if (index == NO_SLOT)
+            {
+                return nullptr;
+            }
+
+            //The slot may be taken and released again before the exchange, which the tag catches
+            uint32_t next = m_next[index].load(std::memory_order_relaxed);
+            if (m_head.value.compare_exchange_weak(head, pack(tag_of(head) + 1, next), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                return &m_values[index];
+            }
+        }
+    }
+
+    /// <summary>
+    /// Returns a slot taken by acquire, from any thread
+    /// </summary>
+    /// <param name="value"></param>
+    inline void release(T* value)
+    {
+        uint32_t index = (uint32_t)(value - m_values.get());
+        uint64_t head = m_head.value.load(std::memory_order_relaxed);
+        do
+        {
+            m_next[index].store((uint32_t)head, std::memory_order_relaxed);
+        } while (!m_head.value.compare_exchange_weak(head, pack(tag_of(head) + 1, index), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    inline size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+private:
+
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    //The head is a slot index, and a tag bumped on every change so a stale head is never exchanged (ABA)
+    static inline uint64_t pack(uint32_t tag, uint32_t index)
+    {
+        return ((uint64_t)tag << 32) | index;
+    }
+
+    static inline uint32_t tag_of(uint64_t head)
+    {
+        return (uint32_t)(head >> 32);
+    }
+
+    std::unique_ptr<T[]> m_values;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_next; //Next free slot after each free slot
+    size_t m_capacity = 0;
+    padded_value<std::atomic<uint64_t>> m_head; //First free slot, claimed by every thread spawning jobs
+};
@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 /// <summary>
 /// Small position struct for storing locations
@@ -48,27 +50,39 @@ inline void position_min(position& inout_base, const position& compare)
 }
 
 /// <summary>
-/// Struct for sparse polycube (only stores filled spaces, empty spaces ignored)
+/// Position without padding, 3 bytes, for arrays of positions that are copied around whole
 /// </summary>
-struct polycube_sparse
+struct packed_position
 {
-    size_t num_cubes;
+    int8_t x, y, z;
+};
 
-    position dim; //Dimensions of the polycube
+inline packed_position pack_position(const position& p)
+{
+    return { p.x, p.y, p.z };
+}
 
-    //Note: assumes max n of 32
-    position cubes[32];
+//Largest polycube the search supports
+const size_t MAX_POLYCUBE_CUBES = 32;
 
-    inline polycube_sparse& operator=(const polycube_sparse& pc)
-    {
-        num_cubes = pc.num_cubes;
-        dim = pc.dim;
-        for (size_t i = 0; i < num_cubes; i++)
-        {
-            cubes[i] = pc.cubes[i];
-        }
-        return *this;
-    }
+//Polycubes up to this size use a sparse polycube under a cache line
+const size_t SMALL_POLYCUBE_CUBES = 16;
+
+/// <summary>
+/// Struct for sparse polycube (only stores filled spaces, empty spaces ignored), with room for Capacity cubes
+/// Trivially copyable and unpadded, so copying one, for each rotation tried, is a short memcpy
+/// </summary>
+/// <typeparam name="Capacity"></typeparam>
+template<size_t Capacity>
+struct polycube_sparse_n
+{
+    static_assert(Capacity <= 255, "num_cubes is a uint8_t");
+
+    uint8_t num_cubes;
+
+    packed_position dim; //Dimensions of the polycube
+
+    packed_position cubes[Capacity];
 
     /// <summary>
     /// Calls a function on each cube in this polycube
@@ -86,6 +100,12 @@ struct polycube_sparse
     }
 };
 
+using polycube_sparse = polycube_sparse_n<MAX_POLYCUBE_CUBES>;
+using polycube_sparse_small = polycube_sparse_n<SMALL_POLYCUBE_CUBES>;
+
+static_assert(std::is_trivially_copyable<polycube_sparse>::value, "sparse polycubes are copied as plain bytes");
+static_assert(sizeof(polycube_sparse_small) <= 64, "small sparse polycubes should fit a cache line");
+
 /// <summary>
 /// Returns smallest power of 10 greater than x, always returns value >= 1
 /// </summary>
@@ -127,19 +147,19 @@ inline int log_smallest_power_of_16(int x)
 /// <param name="pc"></param>
 /// <param name="buffer"></param>
 /// <param name="buf_size"></param>
-inline void str_encoding_hex_sparse(const polycube_sparse& pc, char* buffer, size_t buf_size)
+template<size_t Capacity>
+inline void str_encoding_hex_sparse(const polycube_sparse_n<Capacity>& pc, char* buffer, size_t buf_size)
 {
     size_t idx = 0;
 
     //this works because in ascii, numbers 0 - 9 are less than A-F
     const char map[] = "0123456789ABCDEF";
 
-    //based on pc buffer of size 32
-    int loc[32];
+    int loc[Capacity];
 
     for (int i = 0; i < pc.num_cubes; i++)
     {
-        const position& c = pc.cubes[i];
+        const packed_position& c = pc.cubes[i];
         int label = c.z * (pc.dim.y * (int)pc.dim.x) + c.y * (int)pc.dim.x + c.x;
 
         //We have to sort the polycubes by number
@@ -183,19 +203,19 @@ const int Z_AXIS = 2;
 /// <param name="n"></param>
 /// <param name="axis"></param>
 /// <returns></returns>
-template<int Axis>
-inline polycube_sparse rotate_90_once_sparse(const polycube_sparse& pc)
+template<int Axis, size_t Capacity>
+inline polycube_sparse_n<Capacity> rotate_90_once_sparse(const polycube_sparse_n<Capacity>& pc)
 {
     //rotation around z axis
     if (Axis == Z_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.y, pc.dim.x, pc.dim.z };
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ pc.dim.y - 1 - cube.y, cube.x, cube.z };
+            temp.cubes[i] = packed_position{ pc.dim.y - 1 - cube.y, cube.x, cube.z };
         });
 
         return temp;
@@ -203,14 +223,14 @@ inline polycube_sparse rotate_90_once_sparse(const polycube_sparse& pc)
     //Rotation around y axis
     else if (Axis == Y_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.z , pc.dim.y, pc.dim.x };
 
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{cube.z, cube.y, pc.dim.x - 1 - cube.x };
+            temp.cubes[i] = packed_position{cube.z, cube.y, pc.dim.x - 1 - cube.x };
         });
 
         return temp;
@@ -219,20 +239,20 @@ inline polycube_sparse rotate_90_once_sparse(const polycube_sparse& pc)
     //Rotation around x axis
     else if (Axis == X_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.x, pc.dim.z , pc.dim.y };
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ cube.x, pc.dim.z - 1 - cube.z, cube.y };
+            temp.cubes[i] = packed_position{ cube.x, pc.dim.z - 1 - cube.z, cube.y };
         });
 
         return temp;
     }
 
     printf("ERROR: Invalid axes\n");
-    return polycube_sparse{ 0 };
+    return polycube_sparse_n<Capacity>{};
 }
 
 
@@ -244,19 +264,19 @@ inline polycube_sparse rotate_90_once_sparse(const polycube_sparse& pc)
 /// <param name="n"></param>
 /// <param name="axis"></param>
 /// <returns></returns>
-template<int Axis>
-inline polycube_sparse rotate_90_reverse_sparse(const polycube_sparse& pc)
+template<int Axis, size_t Capacity>
+inline polycube_sparse_n<Capacity> rotate_90_reverse_sparse(const polycube_sparse_n<Capacity>& pc)
 {
     //rotation around z axis
     if (Axis == Z_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.y, pc.dim.x, pc.dim.z };
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ cube.y,  pc.dim.x - 1 - cube.x, cube.z };
+            temp.cubes[i] = packed_position{ cube.y,  pc.dim.x - 1 - cube.x, cube.z };
         });
 
         return temp;
@@ -264,13 +284,13 @@ inline polycube_sparse rotate_90_reverse_sparse(const polycube_sparse& pc)
     //Rotation around y axis
     else if (Axis == Y_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.z , pc.dim.y, pc.dim.x };
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ pc.dim.z - 1 - cube.z, cube.y,  cube.x };
+            temp.cubes[i] = packed_position{ pc.dim.z - 1 - cube.z, cube.y,  cube.x };
         });
 
         return temp;
@@ -279,21 +299,21 @@ inline polycube_sparse rotate_90_reverse_sparse(const polycube_sparse& pc)
     //Rotation around x axis
     else if (Axis == X_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = { pc.dim.x, pc.dim.z , pc.dim.y};
 
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ cube.x, cube.z, pc.dim.y - 1 - cube.y };
+            temp.cubes[i] = packed_position{ cube.x, cube.z, pc.dim.y - 1 - cube.y };
         });
 
         return temp;
     }
 
     printf("ERROR: Invalid axes\n");
-    return polycube_sparse{ 0 };
+    return polycube_sparse_n<Capacity>{};
 }
 
 /// <summary>
@@ -304,19 +324,19 @@ inline polycube_sparse rotate_90_reverse_sparse(const polycube_sparse& pc)
 /// <param name="n"></param>
 /// <param name="axis"></param>
 /// <returns></returns>
-template<int Axis>
-inline polycube_sparse rotate_twice_sparse(const polycube_sparse& pc)
+template<int Axis, size_t Capacity>
+inline polycube_sparse_n<Capacity> rotate_twice_sparse(const polycube_sparse_n<Capacity>& pc)
 {
     //rotation around z axis
     if (Axis == Z_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = pc.dim;
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ pc.dim.x - 1 - cube.x, pc.dim.y - 1 - cube.y, cube.z };
+            temp.cubes[i] = packed_position{ pc.dim.x - 1 - cube.x, pc.dim.y - 1 - cube.y, cube.z };
         });
 
         return temp;
@@ -324,13 +344,13 @@ inline polycube_sparse rotate_twice_sparse(const polycube_sparse& pc)
     //Rotation around y axis
     else if (Axis == Y_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = pc.dim;
 
-        pc.for_each_cube([&](const position& cube, size_t i)
+        pc.for_each_cube([&](const packed_position& cube, size_t i)
         {
-            temp.cubes[i] = position{ pc.dim.x - 1 - cube.x, cube.y,  pc.dim.z - 1 - cube.z };
+            temp.cubes[i] = packed_position{ pc.dim.x - 1 - cube.x, cube.y,  pc.dim.z - 1 - cube.z };
         });
 
         return temp;
@@ -339,42 +359,45 @@ inline polycube_sparse rotate_twice_sparse(const polycube_sparse& pc)
     //Rotation around x axis
     else if (Axis == X_AXIS)
     {
-        polycube_sparse temp;
+        polycube_sparse_n<Capacity> temp;
         temp.num_cubes = pc.num_cubes;
         temp.dim = pc.dim;
 
-        pc.for_each_cube([&](const position& cube, size_t i)        {
+        pc.for_each_cube([&](const packed_position& cube, size_t i)        {
 
-            temp.cubes[i] = position{ cube.x, pc.dim.y - 1 - cube.y,  pc.dim.z - 1 - cube.z };
+            temp.cubes[i] = packed_position{ cube.x, pc.dim.y - 1 - cube.y,  pc.dim.z - 1 - cube.z };
         });
 
         return temp;
     }
 
     printf("ERROR: Invalid axes\n");
-    return polycube_sparse{ 0 };
+    return polycube_sparse_n<Capacity>{};
 }
 
 /// <summary>
 /// An class that iterates through all the rotations of a sparse polycube
 /// </summary>
+template<size_t Capacity>
 class all_rotations_generator_sparse
 {
 
 public:
 
-    all_rotations_generator_sparse(const polycube_sparse& cube) :
+    all_rotations_generator_sparse(const polycube_sparse_n<Capacity>& cube) :
         m_original(cube), m_index(0)
     {
-        m_original = cube;
     }
 
+    //Only a reference to the polycube is kept, so it can't be a temporary
+    all_rotations_generator_sparse(polycube_sparse_n<Capacity>&& cube) = delete;
+
     inline bool has_next() const
     {
         return m_index < 24;
     }
 
-    inline polycube_sparse& next()
+    inline polycube_sparse_n<Capacity>& next()
     {
 
         if (m_index < 4)
@@ -470,8 +493,8 @@ public:
 
 private:
 
-    polycube_sparse m_original;
-    polycube_sparse m_base;
+    const polycube_sparse_n<Capacity>& m_original; //Not copied, must outlive the generator
+    polycube_sparse_n<Capacity> m_base;
 
     int m_index;
 };
@@ -479,23 +502,26 @@ private:
 /// <summary>
 /// A class that iterates through the rotations of a sparse polycube, only obtained from 180 degree rotations about axes
 /// </summary>
+template<size_t Capacity>
 class all_180_rotations_generator_sparse
 {
 
 public:
 
-    all_180_rotations_generator_sparse(const polycube_sparse& cube) :
+    all_180_rotations_generator_sparse(const polycube_sparse_n<Capacity>& cube) :
         m_original(cube), m_index(0)
     {
-        m_original = cube;
     }
 
+    //Only a reference to the polycube is kept, so it can't be a temporary
+    all_180_rotations_generator_sparse(polycube_sparse_n<Capacity>&& cube) = delete;
+
     bool has_next()
     {
         return m_index < 8;
     }
 
-    inline polycube_sparse& next()
+    inline polycube_sparse_n<Capacity>& next()
     {
 
         if (m_index == 0)
@@ -544,8 +570,8 @@ public:
 
 private:
 
-    polycube_sparse m_original;
-    polycube_sparse m_base;
+    const polycube_sparse_n<Capacity>& m_original; //Not copied, must outlive the generator
+    polycube_sparse_n<Capacity> m_base;
 
     int m_index;
 };
@@ -556,7 +582,8 @@ private:
 /// <param name="pc"></param>
 /// <param name="n"></param>
 /// <returns></returns>
-inline bool is_polycube_canonical_sparse(const polycube_sparse& pc, int n)
+template<size_t Capacity>
+inline bool is_polycube_canonical_sparse(const polycube_sparse_n<Capacity>& pc, int n)
 {
 
     if (pc.dim.x < pc.dim.y || pc.dim.x < pc.dim.z || pc.dim.y < pc.dim.z)
@@ -571,7 +598,7 @@ inline bool is_polycube_canonical_sparse(const polycube_sparse& pc, int n)
     //All dim are unique, only need to check eight orientations
     if (pc.dim.x != pc.dim.y && pc.dim.x != pc.dim.z && pc.dim.y != pc.dim.z)
     {
-        polycube_sparse temp = pc;
+        polycube_sparse_n<Capacity> temp = pc;
         //z largest, switch z and y
         if (pc.dim.z >= pc.dim.x && pc.dim.z >= pc.dim.y)
         {
@@ -588,12 +615,12 @@ inline bool is_polycube_canonical_sparse(const polycube_sparse& pc, int n)
             temp = rotate_90_once_sparse<X_AXIS>(temp);
         }
 
-        all_180_rotations_generator_sparse gen(temp);
+        all_180_rotations_generator_sparse<Capacity> gen(temp);
 
         //Now, doing comparisons
         while (gen.has_next())
         {
-            polycube_sparse& cube = gen.next();
+            polycube_sparse_n<Capacity>& cube = gen.next();
 
             char cube_repr[1024];
             str_encoding_hex_sparse(cube, cube_repr, sizeof(cube_repr) / sizeof(char));
@@ -606,12 +633,12 @@ inline bool is_polycube_canonical_sparse(const polycube_sparse& pc, int n)
         return true;
     }
 
-    all_rotations_generator_sparse gen(pc);
+    all_rotations_generator_sparse<Capacity> gen(pc);
 
     //Now, doing comparisons
     while (gen.has_next())
     {
-        polycube_sparse& cube = gen.next();
+        polycube_sparse_n<Capacity>& cube = gen.next();
 
         if (cube.dim.x >= cube.dim.y && cube.dim.y >= cube.dim.z)
         {
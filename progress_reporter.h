@@ -0,0 +1,162 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//////////////////////////////////////////////////
+// Periodic progress reports for long searches, printed from a thread of their own
+//////////////////////////////////////////////////
+
+/// <summary>
+/// A snapshot of how far a search has got
+/// Workers only publish their counters as each seed finishes, so this lags the search by up to a seed per worker
+/// </summary>
+struct search_progress
+{
+    uint64_t seeds_done;
+    uint64_t seeds_total; //0 if not known up front
+    uint64_t cost_done; //Estimated cost of the finished seeds
+    uint64_t cost_total;
+    uint64_t count; //Polycubes found so far
+};
+
+/// <summary>
+/// Formats a number of seconds as e.g. "1h02m05s"
+/// </summary>
+/// <param name="seconds"></param>
+/// <param name="buffer"></param>
+/// <param name="size"></param>
+inline void format_duration(double seconds, char* buffer, size_t size)
+{
+    uint64_t total = (uint64_t)(seconds + 0.5);
+    uint64_t hours = total / 3600, minutes = (total / 60) % 60, secs = total % 60;
+    if (hours > 0)
+    {
+        snprintf(buffer, size, "%lluh%02llum%02llus", (unsigned long long)hours, (unsigned long long)minutes, (unsigned long long)secs);
+    }
+    else if (minutes > 0)
+    {
+        snprintf(buffer, size, "%llum%02llus", (unsigned long long)minutes, (unsigned long long)secs);
+    }
+    else
+    {
+        snprintf(buffer, size, "%llus", (unsigned long long)secs);
+    }
+}
+
+/// <summary>
+/// Formats a line of progress, e.g. "Progress: 3/10 seeds (42.0% of estimated cost), found 1234, ... ETA 1m05s"
+/// The ETA extrapolates the rate estimated seed cost has been finished at so far, over the cost left, and is unknown until some is done
+/// </summary>
+/// <param name="progress"></param>
+/// <param name="elapsed">seconds since the search started</param>
+/// <param name="interval">seconds since the last line</param>
+/// <param name="interval_count">polycubes found since the last line</param>
+/// <param name="buffer"></param>
+/// <param name="size"></param>
+inline void format_progress_line(const search_progress& progress, double elapsed, double interval, uint64_t interval_count, char* buffer, size_t size)
+{
+    char elapsed_text[32], eta_text[32] = "unknown";
+    format_duration(elapsed, elapsed_text, sizeof(elapsed_text));
+    if (progress.cost_done > 0 && progress.cost_total >= progress.cost_done)
+    {
+        format_duration(elapsed * (double)(progress.cost_total - progress.cost_done) / (double)progress.cost_done, eta_text, sizeof(eta_text));
+    }
+
+    char seeds_text[96];
+    if (progress.seeds_total > 0)
+    {
+        double percent = progress.cost_total > 0 ? 100.0 * (double)progress.cost_done / (double)progress.cost_total : 0.0;
+        snprintf(seeds_text, sizeof(seeds_text), "%llu/%llu seeds (%.1f%% of estimated cost)", (unsigned long long)progress.seeds_done,
+            (unsigned long long)progress.seeds_total, percent);
+    }
+    else
+    {
+        snprintf(seeds_text, sizeof(seeds_text), "%llu seeds", (unsigned long long)progress.seeds_done);
+    }
+
+    snprintf(buffer, size, "Progress: %s, found %llu, %.3g polycubes/s (%.3g overall), elapsed %s, ETA %s", seeds_text, (unsigned long long)progress.count,
+        interval > 0 ? interval_count / interval : 0.0, elapsed > 0 ? progress.count / elapsed : 0.0, elapsed_text, eta_text);
+}
+
+/// <summary>
+/// Prints a line of progress every interval, from samples taken on its own thread, until stopped
+/// </summary>
+class progress_reporter
+{
+public:
+
+    ~progress_reporter()
+    {
+        stop();
+    }
+
+    /// <summary>
+    /// Starts reporting, does nothing if interval_seconds is 0
+    /// </summary>
+    /// <param name="interval_seconds"></param>
+    /// <param name="sample">returns the current progress, called from the reporter thread</param>
+    void start(int interval_seconds, std::function<search_progress()> sample)
+    {
+        stop();
+        if (interval_seconds <= 0)
+        {
+            return;
+        }
+
+        m_stopping = false;
+        m_thread = std::thread([this, interval_seconds, sample]() {
+            auto start_time = std::chrono::steady_clock::now();
+            auto last_time = start_time;
+            uint64_t last_count = 0;
+
+            std::unique_lock<std::mutex> lock{ m_mutex };
+            while (!m_stop.wait_for(lock, std::chrono::seconds(interval_seconds), [this]() { return m_stopping; }))
+            {
+                auto now = std::chrono::steady_clock::now();
+                search_progress progress = sample();
+                report(progress, std::chrono::duration<double>(now - start_time).count(), std::chrono::duration<double>(now - last_time).count(), progress.count - last_count);
+                last_time = now;
+                last_count = progress.count;
+            }
+        });
+    }
+
+    /// <summary>
+    /// Stops reporting, and waits for the reporter thread to exit
+    /// </summary>
+    void stop()
+    {
+        if (!m_thread.joinable())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_stopping = true;
+        lock.unlock();
+
+        m_stop.notify_all();
+        m_thread.join();
+    }
+
+private:
+
+    static void report(const search_progress& progress, double elapsed, double interval, uint64_t interval_count)
+    {
+        char line[256];
+        format_progress_line(progress, elapsed, interval, interval_count, line, sizeof(line));
+        printf("%s\n", line);
+        fflush(stdout);
+    }
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_stop;
+    bool m_stopping = false;
+};
@@ -0,0 +1,635 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "cubes.h"
+#include "seed_journal.h"
+#include "seed_results.h"
+
+//////////////////////////////////////////////////
+// Coordinator / worker processes over a unix domain socket
+//
+// The coordinator owns the seed list, and hands batches of seed ids to worker processes that connect to it.
+// Each worker expands its batches with its own thread pool. The protocol is plain text, one message per line:
+//
+//  coordinator -> worker   SEARCH <n> <split> <num_seeds> <seeds_hash>   on connect, the search to join
+//  worker -> coordinator   HELLO                                         worker generated the same seeds
+//  worker -> coordinator   WORK                                          asks for a batch
+//  coordinator -> worker   SEEDS <k> <id_1> ... <id_k>                   a batch of seeds to expand
+//  coordinator -> worker   WAIT                                          nothing to hand out right now, ask again later
+//  coordinator -> worker   DONE                                          every seed is finished
+//  worker -> coordinator   RESULT <id> <count>                           one per seed in a batch
+//
+// Seeds held by a worker that disconnects are handed out again. Once nothing is left to hand out, seeds held
+// by a worker for longer than the reassign time are also handed to idle workers, and the first result wins.
+// Results are journaled as they arrive, so a restarted coordinator only hands out the seeds it has no result for.
+//////////////////////////////////////////////////
+
+#ifndef _WIN32
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// <summary>
+/// Buffers bytes from a socket and splits them into lines
+/// </summary>
+struct socket_line_reader
+{
+    int fd = -1;
+    std::string buffer;
+
+    socket_line_reader() = default;
+
+    explicit socket_line_reader(int socket) : fd(socket)
+    {
+    }
+
+    /// <summary>
+    /// Reads whatever is available from the socket (blocking if nothing is), returns false on disconnect or error
+    /// </summary>
+    /// <returns></returns>
+    inline bool fill()
+    {
+        char chunk[4096];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received <= 0)
+        {
+            return false;
+        }
+        buffer.append(chunk, (size_t)received);
+        return true;
+    }
+
+    /// <summary>
+    /// Takes the next complete line from the buffer, without the newline. Returns false if there isn't one yet
+    /// </summary>
+    /// <param name="out_line"></param>
+    /// <returns></returns>
+    inline bool next_line(std::string& out_line)
+    {
+        size_t end = buffer.find('\n');
+        if (end == std::string::npos)
+        {
+            return false;
+        }
+        out_line = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        return true;
+    }
+
+    /// <summary>
+    /// Blocks until a complete line arrives, returns false on disconnect
+    /// </summary>
+    /// <param name="out_line"></param>
+    /// <returns></returns>
+    inline bool read_line(std::string& out_line)
+    {
+        while (!next_line(out_line))
+        {
+            if (!fill())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/// <summary>
+/// Sends a whole line, returns false if the other end has gone
+/// </summary>
+/// <param name="fd"></param>
+/// <param name="line"></param>
+/// <returns></returns>
+inline bool send_line(int fd, std::string line)
+{
+    line += '\n';
+    size_t sent = 0;
+    while (sent < line.size())
+    {
+        ssize_t result = send(fd, line.data() + sent, line.size() - sent, 0);
+        if (result <= 0)
+        {
+            return false;
+        }
+        sent += (size_t)result;
+    }
+    return true;
+}
+
+/// <summary>
+/// Fills in a unix socket address, returns false if the path is too long
+/// </summary>
+/// <param name="path"></param>
+/// <param name="out_address"></param>
+/// <returns></returns>
+inline bool make_socket_address(const std::string& path, sockaddr_un& out_address)
+{
+    out_address = {};
+    out_address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(out_address.sun_path))
+    {
+        printf("Error! socket path '%s' is too long\n", path.c_str());
+        return false;
+    }
+    strncpy(out_address.sun_path, path.c_str(), sizeof(out_address.sun_path) - 1);
+    return true;
+}
+
+/// <summary>
+/// A worker process connected to the coordinator
+/// </summary>
+struct coordinator_client
+{
+    socket_line_reader reader;
+    std::vector<size_t> held; //seed ids handed to this worker without a result yet
+};
+
+/// <summary>
+/// Per seed bookkeeping on the coordinator
+/// </summary>
+struct coordinator_seed_state
+{
+    bool done = false;
+    int holders = 0; //number of workers currently expanding it
+    std::chrono::steady_clock::time_point handed_out;
+};
+
+/// <summary>
+/// The coordinator's side of the search - the seeds, who holds which, and the results so far. Driven by poll_once,
+/// with workers added as they connect, so it can run over any connected sockets
+/// Every result is appended to a seed journal as it arrives, so a coordinator that's restarted with resume
+/// picks up where it was, rather than losing every result collected
+/// </summary>
+class seed_coordinator
+{
+public:
+
+    seed_coordinator() = default;
+    seed_coordinator(const seed_coordinator&) = delete;
+    seed_coordinator& operator=(const seed_coordinator&) = delete;
+
+    ~seed_coordinator()
+    {
+        for (coordinator_client& client : m_clients)
+        {
+            close(client.reader.fd);
+        }
+    }
+
+    /// <summary>
+    /// Generates the seeds for a search of size n split on seeds of size split_depth, and opens the journal results are
+    /// recorded in. When resuming, seeds already in the journal are done, and only the rest are handed out
+    /// </summary>
+    /// <returns></returns>
+    bool start(int n, int split_depth, int reassign_after_seconds, const std::string& journal_path, bool resume)
+    {
+        stack_allocator allocator;
+        m_seeds = generate_seeds(allocator, split_depth);
+        m_header = { n, split_depth, m_seeds.size(), hash_seeds(m_seeds), 0, 1 };
+        m_reassign_after_seconds = reassign_after_seconds;
+
+        if (!m_journal.open(journal_path, m_header, resume))
+        {
+            return false;
+        }
+
+        m_states.assign(m_seeds.size(), coordinator_seed_state());
+        m_pending.clear();
+        for (size_t id = 0; id < m_seeds.size(); id++)
+        {
+            if (m_journal.is_done(id))
+            {
+                m_states[id].done = true;
+            }
+            else
+            {
+                m_pending.push_back(id);
+            }
+        }
+
+        if (m_journal.num_done() > 0)
+        {
+            printf("Resuming from %s: %llu of %llu seeds already done\n", journal_path.c_str(), (unsigned long long)m_journal.num_done(),
+                (unsigned long long)m_seeds.size());
+        }
+
+        snprintf(m_search_message, sizeof(m_search_message), "SEARCH %d %d %llu %llx", n, split_depth, (unsigned long long)m_seeds.size(),
+            (unsigned long long)m_header.seeds_hash);
+        return true;
+    }
+
+    /// <summary>
+    /// Takes on a connected worker, telling it which search to join. The coordinator closes fd once the worker is dropped
+    /// </summary>
+    /// <param name="fd"></param>
+    void add_client(int fd)
+    {
+        if (!send_line(fd, m_search_message))
+        {
+            close(fd);
+            return;
+        }
+
+        coordinator_client client;
+        client.reader.fd = fd;
+        m_clients.push_back(client);
+    }
+
+    /// <summary>
+    /// Waits up to timeout_ms for messages from workers, or a worker connecting on listener, and handles them
+    /// listener can be -1 for none
+    /// </summary>
+    /// <param name="listener"></param>
+    /// <param name="timeout_ms"></param>
+    void poll_once(int listener, int timeout_ms)
+    {
+        std::vector<pollfd> fds;
+        fds.push_back({ listener, POLLIN, 0 });
+        for (const coordinator_client& client : m_clients)
+        {
+            fds.push_back({ client.reader.fd, POLLIN, 0 });
+        }
+
+        if (poll(fds.data(), fds.size(), timeout_ms) <= 0)
+        {
+            return;
+        }
+
+        //Walk backwards, so dropping a client doesn't disturb the indices still to be checked
+        for (size_t i = m_clients.size(); i > 0; i--)
+        {
+            size_t index = i - 1;
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+
+            bool ok = m_clients[index].reader.fill();
+            std::string line;
+            while (ok && m_clients[index].reader.next_line(line))
+            {
+                ok = handle_line(m_clients[index], line);
+            }
+
+            if (!ok)
+            {
+                drop_client(index);
+            }
+        }
+
+        if (listener >= 0 && (fds[0].revents & POLLIN))
+        {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0)
+            {
+                add_client(fd);
+            }
+        }
+    }
+
+    inline bool finished() const
+    {
+        return m_journal.num_done() == m_seeds.size();
+    }
+
+    inline size_t num_done() const
+    {
+        return m_journal.num_done();
+    }
+
+    inline size_t num_seeds() const
+    {
+        return m_seeds.size();
+    }
+
+    inline size_t num_clients() const
+    {
+        return m_clients.size();
+    }
+
+    inline output_t total() const
+    {
+        return m_journal.total();
+    }
+
+    inline const seed_results_header& header() const
+    {
+        return m_header;
+    }
+
+    /// <summary>
+    /// Writes the result of every seed to a ledger, in the same format as shard results. Only once finished
+    /// </summary>
+    /// <param name="path"></param>
+    /// <returns></returns>
+    bool write_ledger(const std::string& path)
+    {
+        m_journal.close();
+
+        std::vector<seed_result> results;
+        for (size_t id = 0; id < m_seeds.size(); id++)
+        {
+            results.push_back({ id, m_journal.count(id) });
+        }
+        return write_seed_results(path, m_header, results);
+    }
+
+private:
+
+    //Seeds held by a dropped worker go back to the front of the queue, unless someone else also holds them
+    void drop_client(size_t index)
+    {
+        for (size_t id : m_clients[index].held)
+        {
+            m_states[id].holders--;
+            if (!m_states[id].done && m_states[id].holders == 0)
+            {
+                m_pending.push_front(id);
+            }
+        }
+        printf("Worker disconnected, %llu seeds returned\n", (unsigned long long)m_clients[index].held.size());
+        close(m_clients[index].reader.fd);
+        m_clients.erase(m_clients.begin() + index);
+    }
+
+    bool hand_out(coordinator_client& client)
+    {
+        std::vector<size_t> batch;
+        size_t batch_size = std::min(std::max(m_pending.size() / (SEED_CHUNK_DIVISOR * m_clients.size()), (size_t)1), MAX_SEED_CHUNK);
+
+        while (!m_pending.empty() && batch.size() < batch_size)
+        {
+            size_t id = m_pending.front();
+            m_pending.pop_front();
+            if (!m_states[id].done)
+            {
+                batch.push_back(id);
+            }
+        }
+
+        //Nothing left to hand out, so back up seeds another worker has been holding too long
+        if (batch.empty() && m_reassign_after_seconds > 0)
+        {
+            auto now = std::chrono::steady_clock::now();
+            for (size_t id = 0; id < m_states.size() && batch.size() < batch_size; id++)
+            {
+                if (!m_states[id].done && m_states[id].holders == 1 && now - m_states[id].handed_out > std::chrono::seconds(m_reassign_after_seconds))
+                {
+                    batch.push_back(id);
+                }
+            }
+        }
+
+        if (batch.empty())
+        {
+            return send_line(client.reader.fd, finished() ? "DONE" : "WAIT");
+        }
+
+        std::string message = "SEEDS " + std::to_string(batch.size());
+        for (size_t id : batch)
+        {
+            message += " " + std::to_string(id);
+            m_states[id].holders++;
+            m_states[id].handed_out = std::chrono::steady_clock::now();
+            client.held.push_back(id);
+        }
+        return send_line(client.reader.fd, message);
+    }
+
+    //Returns false if the client sent something it shouldn't have
+    bool handle_line(coordinator_client& client, const std::string& line)
+    {
+        unsigned long long id, count;
+        if (line == "HELLO")
+        {
+            printf("Worker joined, %llu workers\n", (unsigned long long)m_clients.size());
+            return true;
+        }
+        else if (line == "WORK")
+        {
+            return hand_out(client);
+        }
+        else if (sscanf(line.c_str(), "RESULT %llu %llu", &id, &count) == 2 && id < m_seeds.size())
+        {
+            auto held = std::find(client.held.begin(), client.held.end(), (size_t)id);
+            if (held == client.held.end())
+            {
+                printf("Error! worker sent a result for seed %llu it doesn't hold\n", id);
+                return false;
+            }
+            client.held.erase(held);
+            m_states[id].holders--;
+
+            if (!m_states[id].done)
+            {
+                m_states[id].done = true;
+                //Each result stands for a seed's whole search on another machine, so it's synced as it arrives
+                m_journal.record((size_t)id, (output_t)count, true);
+            }
+            else if (m_journal.count((size_t)id) != count)
+            {
+                printf("Warning! seed %llu has two different results, %llu and %llu\n", id, (unsigned long long)m_journal.count((size_t)id), count);
+            }
+            return true;
+        }
+
+        printf("Error! unexpected message '%s'\n", line.c_str());
+        return false;
+    }
+
+    std::vector<polycube_seed> m_seeds;
+    seed_results_header m_header{};
+    int m_reassign_after_seconds = 0;
+    char m_search_message[256] = {};
+
+    seed_journal m_journal; //Every result, as it arrives
+    std::vector<coordinator_seed_state> m_states;
+    std::deque<size_t> m_pending;
+    std::vector<coordinator_client> m_clients;
+};
+
+/// <summary>
+/// Runs the coordinator for a search of size n split on seeds of size split_depth, until every seed has a result
+/// Results are journaled to journal_path as they arrive, and reloaded from it when resuming after a crash or restart
+/// Per seed results are written to ledger_path, in the same format as shard results, so they can be merged and checked
+/// </summary>
+/// <returns>the process exit code</returns>
+inline int run_coordinator(const std::string& socket_path, int n, int split_depth, int reassign_after_seconds, const std::string& ledger_path,
+    const std::string& journal_path, bool resume)
+{
+    //Writing to a worker that's gone should be an error return, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    seed_coordinator coordinator;
+    if (!coordinator.start(n, split_depth, reassign_after_seconds, journal_path, resume))
+    {
+        return -1;
+    }
+
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address))
+    {
+        return -1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        printf("Error! could not listen on '%s'\n", socket_path.c_str());
+        return -1;
+    }
+
+    printf("Coordinating %llu seeds on %s, journaled to %s\n", (unsigned long long)coordinator.num_seeds(), socket_path.c_str(), journal_path.c_str());
+
+    //Wake up regularly, so overdue seeds are noticed even when nothing is happening
+    while (!coordinator.finished())
+    {
+        coordinator.poll_once(listener, 1000);
+    }
+
+    //Workers waiting on us see the socket close when the coordinator goes, and stop
+    close(listener);
+    unlink(socket_path.c_str());
+
+    if (!coordinator.write_ledger(ledger_path))
+    {
+        return -1;
+    }
+
+    printf("Results for all %llu seeds written to %s\n", (unsigned long long)coordinator.num_seeds(), ledger_path.c_str());
+    printf("For n = {%d}, found {%llu} polycubes\n", n, (unsigned long long)coordinator.total());
+    return 0;
+}
+
+/// <summary>
+/// Connects to a coordinator, and expands the batches of seeds it hands out on the pool until it says everything is done
+/// </summary>
+/// <returns>the process exit code</returns>
+inline int run_socket_worker(const std::string& socket_path, polycubes_thread_pool& pool)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un address;
+    if (!make_socket_address(socket_path, address))
+    {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+    {
+        printf("Error! could not connect to '%s'\n", socket_path.c_str());
+        return -1;
+    }
+
+    socket_line_reader reader{ fd };
+    std::string line;
+
+    int n, split_depth;
+    unsigned long long num_seeds, seeds_hash;
+    if (!reader.read_line(line) || sscanf(line.c_str(), "SEARCH %d %d %llu %llx", &n, &split_depth, &num_seeds, &seeds_hash) != 4)
+    {
+        printf("Error! coordinator didn't describe the search\n");
+        close(fd);
+        return -1;
+    }
+
+    //Seed ids only mean the same thing on both ends if both generated exactly the same seeds
+    stack_allocator allocator;
+    std::vector<polycube_seed> seeds = pool.generate_seeds_parallel(allocator, split_depth);
+    if (seeds.size() != num_seeds || hash_seeds(seeds) != seeds_hash)
+    {
+        printf("Error! seeds generated here don't match the coordinator's\n");
+        close(fd);
+        return -1;
+    }
+
+    printf("Joined search for n = %d, %llu seeds of size %d\n", n, num_seeds, split_depth);
+
+    size_t seeds_expanded = 0;
+    bool running = send_line(fd, "HELLO") && send_line(fd, "WORK");
+    while (running && reader.read_line(line))
+    {
+        if (line == "DONE")
+        {
+            break;
+        }
+        else if (line == "WAIT")
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            running = send_line(fd, "WORK");
+            continue;
+        }
+
+        std::istringstream message(line);
+        std::string type;
+        size_t k = 0;
+        message >> type >> k;
+
+        std::vector<size_t> seed_ids;
+        size_t id;
+        while (seed_ids.size() < k && message >> id)
+        {
+            if (id < seeds.size())
+            {
+                seed_ids.push_back(id);
+            }
+        }
+
+        if (type != "SEEDS" || seed_ids.size() != k)
+        {
+            printf("Error! unexpected message '%s'\n", line.c_str());
+            break;
+        }
+
+        std::vector<output_t> seed_counts;
+        std::vector<uint8_t> seed_done;
+        pool.expand_seeds(allocator, n, seeds, seed_ids, &seed_counts, seed_search_hooks(), &seed_done);
+
+        //Only finished seeds are reported, the coordinator hands the rest out again once this worker disconnects
+        for (size_t i = 0; i < seed_ids.size() && running; i++)
+        {
+            if (seed_done[seed_ids[i]])
+            {
+                seeds_expanded++;
+                running = send_line(fd, "RESULT " + std::to_string(seed_ids[i]) + " " + std::to_string(seed_counts[seed_ids[i]]));
+            }
+        }
+
+        if (pool.was_stopped())
+        {
+            printf("Stopped early, leaving the seeds still held to the coordinator\n");
+            break;
+        }
+        running = running && send_line(fd, "WORK");
+    }
+
+    close(fd);
+    printf("Worker finished, expanded %llu seeds\n", (unsigned long long)seeds_expanded);
+    return 0;
+}
+
+#else
+
+inline int run_coordinator(const std::string&, int, int, int, const std::string&, const std::string&, bool)
+{
+    printf("Error! coordinator mode needs unix domain sockets, not supported on this platform\n");
+    return -1;
+}
+
+inline int run_socket_worker(const std::string&, polycubes_thread_pool&)
+{
+    printf("Error! worker mode needs unix domain sockets, not supported on this platform\n");
+    return -1;
+}
+
+#endif
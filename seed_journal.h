@@ -0,0 +1,344 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "cubes.h"
+#include "seed_results.h"
+
+//////////////////////////////////////////////////
+// Append only journal of finished seeds, so a long search can resume after a crash
+//////////////////////////////////////////////////
+
+const char* const SEED_JOURNAL_MAGIC = "polycubes-seed-journal";
+const int SEED_JOURNAL_VERSION = 2; //Version 1 journals have no partial records, and still load
+
+//Records are synced to disk once this many are waiting, or this long after the last sync, whichever is first
+const size_t JOURNAL_SYNC_BATCH = 64;
+const int JOURNAL_SYNC_SECONDS = 5;
+
+/// <summary>
+/// Flushes a file through to the disk
+/// </summary>
+/// <param name="file"></param>
+inline void sync_file(FILE* file)
+{
+    fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+/// <summary>
+/// Journal of the seeds finished in a search, and their counts
+/// The file is a header line then one "id count" line per finished seed. Appends are synced in batches,
+/// so a crash loses at most a batch of results, and a torn last line is dropped on resume
+/// Seeds part way through are recorded as "P id partial_count k label_1 ... label_k" lines, the latest one for a seed wins
+/// </summary>
+class seed_journal
+{
+public:
+
+    ~seed_journal()
+    {
+        close();
+    }
+
+    /// <summary>
+    /// Opens the journal for a search. When resuming from an existing file, loads the seeds already finished,
+    /// and refuses if the file is from a different search. Otherwise starts a new journal, refusing to replace an existing one,
+    /// which could hold days of results
+    /// </summary>
+    /// <param name="path"></param>
+    /// <param name="header"></param>
+    /// <param name="resume"></param>
+    /// <returns></returns>
+    bool open(const std::string& path, const seed_results_header& header, bool resume)
+    {
+        m_done.assign(header.num_seeds, 0);
+        m_counts.assign(header.num_seeds, 0);
+        m_resume.clear();
+        m_resume.resize(header.num_seeds);
+        m_num_done = 0;
+        m_total = 0;
+
+        std::ifstream existing(path);
+        if (existing && !resume)
+        {
+            printf("Error! journal '%s' already exists, pass --resume to carry on from it, or move it aside to start again\n", path.c_str());
+            return false;
+        }
+        if (existing)
+        {
+            if (!load(existing, path, header))
+            {
+                return false;
+            }
+        }
+        existing.close();
+
+        //Rewrite what was loaded to a fresh file first, so appends never follow a torn line
+        std::string temp_path = path + ".tmp";
+        FILE* file = fopen(temp_path.c_str(), "w");
+        if (!file)
+        {
+            printf("Error! could not open journal '%s'\n", temp_path.c_str());
+            return false;
+        }
+
+        fprintf(file, "%s %d n %d split %d seeds %llu seeds_hash %llx shard %llu %llu\n", SEED_JOURNAL_MAGIC, SEED_JOURNAL_VERSION,
+            header.n, header.split_depth, (unsigned long long)header.num_seeds, (unsigned long long)header.seeds_hash,
+            (unsigned long long)header.shard_index, (unsigned long long)header.shard_count);
+        for (size_t id = 0; id < m_done.size(); id++)
+        {
+            if (m_done[id])
+            {
+                fprintf(file, "%llu %llu\n", (unsigned long long)id, (unsigned long long)m_counts[id]);
+            }
+            else if (m_resume[id])
+            {
+                write_partial(file, id, *m_resume[id]);
+            }
+        }
+        sync_file(file);
+        fclose(file);
+
+        //rename replaces the journal in one step on posix, so a crash leaves either the old journal or the new one.
+        //Windows won't rename over an existing file
+#ifdef _WIN32
+        remove(path.c_str());
+#endif
+        if (rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            printf("Error! could not replace journal '%s'\n", path.c_str());
+            return false;
+        }
+
+        m_file = fopen(path.c_str(), "a");
+        if (!m_file)
+        {
+            printf("Error! could not open journal '%s'\n", path.c_str());
+            return false;
+        }
+
+        m_unsynced = 0;
+        m_last_sync = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    /// <summary>
+    /// Where to resume a seed that was part way through, or nullptr to start it from scratch
+    /// Only valid until the seed is recorded again, or checkpointed again
+    /// </summary>
+    /// <param name="id"></param>
+    /// <returns></returns>
+    inline const seed_resume_point* resume_point(size_t id) const
+    {
+        return m_resume[id].get();
+    }
+
+    inline bool is_done(size_t id) const
+    {
+        return m_done[id] != 0;
+    }
+
+    inline output_t count(size_t id) const
+    {
+        return m_counts[id];
+    }
+
+    inline size_t num_done() const
+    {
+        return m_num_done;
+    }
+
+    inline output_t total() const
+    {
+        return m_total;
+    }
+
+    /// <summary>
+    /// Appends a finished seed. Safe to call from any thread
+    /// Synced with the batch unless sync_now is set, for records too costly to lose even a batch of
+    /// </summary>
+    /// <param name="id"></param>
+    /// <param name="count"></param>
+    /// <param name="sync_now"></param>
+    void record(size_t id, output_t count, bool sync_now = false)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+
+        if (m_done[id])
+        {
+            return;
+        }
+        m_done[id] = 1;
+        m_counts[id] = count;
+        m_num_done++;
+        m_total += count;
+
+        fprintf(m_file, "%llu %llu\n", (unsigned long long)id, (unsigned long long)count);
+        m_unsynced++;
+
+        auto now = std::chrono::steady_clock::now();
+        if (sync_now || m_unsynced >= JOURNAL_SYNC_BATCH || now - m_last_sync > std::chrono::seconds(JOURNAL_SYNC_SECONDS))
+        {
+            sync_file(m_file);
+            m_unsynced = 0;
+            m_last_sync = now;
+        }
+    }
+
+    /// <summary>
+    /// Appends a checkpoint part way through a seed, and syncs it straight away. Safe to call from any thread
+    /// Checkpoints are rate limited by the caller, so aren't batched
+    /// </summary>
+    /// <param name="id"></param>
+    /// <param name="point"></param>
+    void record_partial(size_t id, const seed_resume_point& point)
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+
+        if (m_done[id])
+        {
+            return;
+        }
+
+        write_partial(m_file, id, point);
+        sync_file(m_file);
+        m_resume[id].reset(new seed_resume_point(point));
+        m_unsynced = 0;
+        m_last_sync = std::chrono::steady_clock::now();
+    }
+
+    /// <summary>
+    /// Syncs anything outstanding and closes the file
+    /// </summary>
+    void close()
+    {
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        if (m_file)
+        {
+            sync_file(m_file);
+            fclose(m_file);
+            m_file = nullptr;
+        }
+    }
+
+private:
+
+    static void write_partial(FILE* file, size_t id, const seed_resume_point& point)
+    {
+        fprintf(file, "P %llu %llu %llu", (unsigned long long)id, (unsigned long long)point.partial_count, (unsigned long long)point.labels.size());
+        for (uint8_t label : point.labels)
+        {
+            fprintf(file, " %d", (int)label);
+        }
+        fprintf(file, "\n");
+    }
+
+    bool load(std::ifstream& in, const std::string& path, const seed_results_header& header)
+    {
+        std::string line;
+        std::getline(in, line);
+
+        char magic[64];
+        int version, n, split_depth;
+        unsigned long long num_seeds, seeds_hash, shard_index, shard_count;
+        if (sscanf(line.c_str(), "%63s %d n %d split %d seeds %llu seeds_hash %llx shard %llu %llu", magic, &version, &n, &split_depth,
+                &num_seeds, &seeds_hash, &shard_index, &shard_count) != 8
+            || std::string(magic) != SEED_JOURNAL_MAGIC || version < 1 || version > SEED_JOURNAL_VERSION)
+        {
+            printf("Error! '%s' is not a seed journal\n", path.c_str());
+            return false;
+        }
+
+        if (n != header.n || split_depth != header.split_depth || num_seeds != header.num_seeds || seeds_hash != header.seeds_hash
+            || shard_index != header.shard_index || shard_count != header.shard_count)
+        {
+            printf("Error! journal '%s' is from a different search, refusing to resume\n", path.c_str());
+            return false;
+        }
+
+        while (std::getline(in, line))
+        {
+            //A line without its newline was torn by a crash mid write
+            if (in.eof())
+            {
+                break;
+            }
+
+            unsigned long long id, count;
+
+            if (line.size() > 0 && line[0] == 'P')
+            {
+                std::istringstream partial(line.substr(1));
+                std::unique_ptr<seed_resume_point> point(new seed_resume_point());
+                size_t num_labels = 0;
+                partial >> id >> count >> num_labels;
+
+                int label;
+                while (point->labels.size() < num_labels && partial >> label)
+                {
+                    point->labels.push_back((uint8_t)label);
+                }
+
+                if (!partial || id >= m_done.size() || point->labels.size() != num_labels)
+                {
+                    printf("Error! journal '%s' has a bad record '%s'\n", path.c_str(), line.c_str());
+                    return false;
+                }
+
+                point->partial_count = (output_t)count;
+                if (!m_done[id])
+                {
+                    m_resume[id] = std::move(point);
+                }
+                continue;
+            }
+
+            if (sscanf(line.c_str(), "%llu %llu", &id, &count) != 2 || id >= m_done.size())
+            {
+                printf("Error! journal '%s' has a bad record '%s'\n", path.c_str(), line.c_str());
+                return false;
+            }
+
+            if (!m_done[id])
+            {
+                m_done[id] = 1;
+                m_counts[id] = (output_t)count;
+                m_num_done++;
+                m_total += (output_t)count;
+                m_resume[id].reset();
+            }
+        }
+
+        return true;
+    }
+
+    FILE* m_file = nullptr;
+    std::mutex m_mutex;
+
+    std::vector<uint8_t> m_done;
+    std::vector<output_t> m_counts;
+    std::vector<std::unique_ptr<seed_resume_point>> m_resume; //Latest checkpoint of each unfinished seed, loaded on resume
+    size_t m_num_done = 0;
+    output_t m_total = 0;
+
+    size_t m_unsynced = 0;
+    std::chrono::steady_clock::time_point m_last_sync;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "cubes.h"
+
+//////////////////////////////////////////////////
+// Per seed result files, for splitting a search across processes / machines
+//////////////////////////////////////////////////
+
+const char* const SEED_RESULTS_MAGIC = "polycubes-seed-results";
+const int SEED_RESULTS_VERSION = 1;
+
+/// <summary>
+/// Describes which search a set of per seed results came from, so results from different searches are never mixed
+/// </summary>
+struct seed_results_header
+{
+    int n; //Size of polycubes counted
+    int split_depth; //Size of the seeds
+    size_t num_seeds; //Number of seeds of that size
+    uint64_t seeds_hash; //Hash of the whole seed array, see hash_seeds
+    size_t shard_index;
+    size_t shard_count;
+};
+
+/// <summary>
+/// Number of polycubes of size n found from a single seed
+/// </summary>
+struct seed_result
+{
+    size_t seed_id;
+    output_t count;
+};
+
+/// <summary>
+/// FNV-1a hash of a seed array. Seeds are plain bytes, so this is the same on every machine that generates the same seeds
+/// </summary>
+/// <param name="seeds"></param>
+/// <returns></returns>
+inline uint64_t hash_seeds(const std::vector<polycube_seed>& seeds)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const uint8_t* bytes = (const uint8_t*)seeds.data();
+    for (size_t i = 0; i < seeds.size() * sizeof(polycube_seed); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// <summary>
+/// Parses a shard description of the form "i/N", with i < N
+/// </summary>
+/// <param name="text"></param>
+/// <param name="out_index"></param>
+/// <param name="out_count"></param>
+/// <returns></returns>
+inline bool parse_shard(const std::string& text, size_t& out_index, size_t& out_count)
+{
+    unsigned long long index, count;
+    char trailing;
+    if (sscanf(text.c_str(), "%llu/%llu%c", &index, &count, &trailing) != 2 || count == 0 || index >= count)
+    {
+        printf("Error! shard must be i/N with 0 <= i < N, got '%s'\n", text.c_str());
+        return false;
+    }
+    out_index = (size_t)index;
+    out_count = (size_t)count;
+    return true;
+}
+
+/// <summary>
+/// Ids of the seeds belonging to a shard. Seeds are dealt out round robin, as neighbouring seeds tend to have similar costs
+/// </summary>
+/// <param name="num_seeds"></param>
+/// <param name="shard_index"></param>
+/// <param name="shard_count"></param>
+/// <returns></returns>
+inline std::vector<size_t> select_shard_seeds(size_t num_seeds, size_t shard_index, size_t shard_count)
+{
+    std::vector<size_t> ids;
+    for (size_t id = shard_index; id < num_seeds; id += shard_count)
+    {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+/// <summary>
+/// Writes a header and per seed results to a text file
+/// </summary>
+/// <param name="path"></param>
+/// <param name="header"></param>
+/// <param name="results"></param>
+/// <returns></returns>
+inline bool write_seed_results(const std::string& path, const seed_results_header& header, const std::vector<seed_result>& results)
+{
+    std::ofstream out(path, std::ios::trunc);
+    if (!out)
+    {
+        printf("Error! could not open '%s' for writing\n", path.c_str());
+        return false;
+    }
+
+    out << SEED_RESULTS_MAGIC << " " << SEED_RESULTS_VERSION << "\n";
+    out << "n " << header.n << "\n";
+    out << "split " << header.split_depth << "\n";
+    out << "seeds " << header.num_seeds << "\n";
+    out << "seeds_hash " << std::hex << header.seeds_hash << std::dec << "\n";
+    out << "shard " << header.shard_index << " " << header.shard_count << "\n";
+    out << "results " << results.size() << "\n";
+
+    for (const seed_result& result : results)
+    {
+        out << result.seed_id << " " << result.count << "\n";
+    }
+
+    out.flush();
+    if (!out)
+    {
+        printf("Error! failed writing '%s'\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// Reads a file written by write_seed_results, returns false if it's malformed or truncated
+/// </summary>
+/// <param name="path"></param>
+/// <param name="out_header"></param>
+/// <param name="out_results"></param>
+/// <returns></returns>
+inline bool read_seed_results(const std::string& path, seed_results_header& out_header, std::vector<seed_result>& out_results)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        printf("Error! could not open '%s'\n", path.c_str());
+        return false;
+    }
+
+    std::string magic, key_n, key_split, key_seeds, key_hash, key_shard, key_results;
+    int version = 0;
+    size_t num_results = 0;
+
+    in >> magic >> version;
+    in >> key_n >> out_header.n;
+    in >> key_split >> out_header.split_depth;
+    in >> key_seeds >> out_header.num_seeds;
+    in >> key_hash >> std::hex >> out_header.seeds_hash >> std::dec;
+    in >> key_shard >> out_header.shard_index >> out_header.shard_count;
+    in >> key_results >> num_results;
+
+    if (!in || magic != SEED_RESULTS_MAGIC || version != SEED_RESULTS_VERSION
+        || key_n != "n" || key_split != "split" || key_seeds != "seeds" || key_hash != "seeds_hash" || key_shard != "shard" || key_results != "results")
+    {
+        printf("Error! '%s' is not a seed results file\n", path.c_str());
+        return false;
+    }
+
+    out_results.clear();
+    for (size_t i = 0; i < num_results; i++)
+    {
+        seed_result result;
+        if (!(in >> result.seed_id >> result.count))
+        {
+            printf("Error! '%s' is truncated, expected %llu results, found %llu\n", path.c_str(), (unsigned long long)num_results, (unsigned long long)i);
+            return false;
+        }
+        out_results.push_back(result);
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Sums the results from a set of shard files. Refuses to merge if the files come from different searches,
+/// or if any seed is missing or appears more than once
+/// </summary>
+/// <param name="paths"></param>
+/// <param name="out_header">header of the first file</param>
+/// <param name="out_total"></param>
+/// <returns></returns>
+inline bool merge_seed_results(const std::vector<std::string>& paths, seed_results_header& out_header, size_t& out_total)
+{
+    if (paths.empty())
+    {
+        printf("Error! no result files to merge\n");
+        return false;
+    }
+
+    std::vector<int> owner; //index of the file each seed was found in, -1 if not yet seen
+    out_total = 0;
+
+    for (size_t f = 0; f < paths.size(); f++)
+    {
+        seed_results_header header;
+        std::vector<seed_result> results;
+        if (!read_seed_results(paths[f], header, results))
+        {
+            return false;
+        }
+
+        if (f == 0)
+        {
+            out_header = header;
+            owner.assign(header.num_seeds, -1);
+        }
+        else if (header.n != out_header.n || header.split_depth != out_header.split_depth || header.num_seeds != out_header.num_seeds
+            || header.seeds_hash != out_header.seeds_hash || header.shard_count != out_header.shard_count)
+        {
+            printf("Error! '%s' is from a different search than '%s'\n", paths[f].c_str(), paths[0].c_str());
+            return false;
+        }
+
+        for (const seed_result& result : results)
+        {
+            if (result.seed_id >= owner.size())
+            {
+                printf("Error! '%s' has seed %llu, but there are only %llu seeds\n", paths[f].c_str(), (unsigned long long)result.seed_id, (unsigned long long)owner.size());
+                return false;
+            }
+            if (owner[result.seed_id] >= 0)
+            {
+                printf("Error! seed %llu appears in both '%s' and '%s'\n", (unsigned long long)result.seed_id, paths[owner[result.seed_id]].c_str(), paths[f].c_str());
+                return false;
+            }
+            owner[result.seed_id] = (int)f;
+            out_total += result.count;
+        }
+    }
+
+    size_t missing = 0;
+    for (size_t id = 0; id < owner.size(); id++)
+    {
+        if (owner[id] < 0)
+        {
+            if (missing < 10)
+            {
+                printf("Missing seed %llu (shard %llu)\n", (unsigned long long)id, (unsigned long long)(id % out_header.shard_count));
+            }
+            missing++;
+        }
+    }
+
+    if (missing > 0)
+    {
+        printf("Error! %llu of %llu seeds missing, refusing to merge\n", (unsigned long long)missing, (unsigned long long)owner.size());
+        return false;
+    }
+
+    return true;
+}
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 
 #include <memory>
+#include <new>
+#include <vector>
+
+#include "huge_pages.h"
 
 #ifdef GENERIC_STACK
 
@@ -120,8 +126,15 @@ private:
 };
 #else 
 
+//Most chunks a typed stack allocator grows to, a guard against runaway recursion rather than a real limit on n
+const size_t MAX_STACK_CHUNKS = 64;
+
 /// <summary>
 /// A stack allocator for only a specific type
+/// Grows by chaining chunks of at least N elements as they're needed, so elements never move once allocated
+/// Chunks are kept when released, so a thread's allocator settles at the size of its deepest search
+/// Chunk memory comes from page_buffers. With huge pages on, chunks are sized to fill whole huge pages, which for
+/// large elements means more than N, fixed by the huge page setting in force when the first chunk is chained
 /// </summary>
 /// <typeparam name="T"></typeparam>
 template<typename T, size_t N>
@@ -131,21 +144,91 @@ public:
     inline size_t get_marker() const { return m_ptr; }
     inline void set_marker(size_t marker) { m_ptr = marker; }
 
+    /// <summary>
+    /// Allocates the next element. Never returns nullptr - running out of chunks means a search is far deeper than any
+    /// polycube can be, so it's reported and the process aborts rather than carrying on with a null frame
+    /// </summary>
+    /// <returns></returns>
     inline T* allocate() 
     { 
-        if (m_ptr >= N)
+        size_t chunk = m_ptr / m_chunk_elements;
+        if (chunk >= m_chunks.size())
         {
-            return nullptr;
+            grow();
+            chunk = m_ptr / m_chunk_elements; //The first chunk decides how many elements a chunk holds
         }
-        T* next = &stack[m_ptr++];
+        T* next = &m_chunks[chunk].elements[m_ptr % m_chunk_elements];
+        m_ptr++;
 
         //*next = T{};
 
         return next;
     }
 
+    /// <summary>
+    /// Number of elements the allocator can hold without growing
+    /// </summary>
+    inline size_t capacity() const
+    {
+        return m_chunks.size() * m_chunk_elements;
+    }
+
 private:
-    std::unique_ptr<T[]> stack = std::unique_ptr<T[]>(new T[N]);
+
+    void grow()
+    {
+        if (m_chunks.size() >= MAX_STACK_CHUNKS)
+        {
+            printf("Error! stack allocator overflow, %llu elements in use, the limit is %llu (MAX_STACK_CHUNKS chunks of %llu)\n",
+                (unsigned long long)m_ptr, (unsigned long long)(MAX_STACK_CHUNKS * m_chunk_elements), (unsigned long long)m_chunk_elements);
+            fflush(stdout);
+            std::abort();
+        }
+
+        if (m_chunks.empty())
+        {
+            m_chunk_elements = huge_page_elements(sizeof(T), N);
+        }
+        m_chunks.emplace_back(m_chunk_elements);
+    }
+
+    /// <summary>
+    /// count elements, constructed in place in a page_buffer
+    /// </summary>
+    struct chunk
+    {
+        explicit chunk(size_t count) : memory(sizeof(T) * count), elements((T*)memory.data()), count(count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                new (&elements[i]) T;
+            }
+        }
+
+        chunk(chunk&& other) noexcept : memory(std::move(other.memory)), elements(other.elements), count(other.count)
+        {
+            other.elements = nullptr;
+        }
+
+        chunk(const chunk&) = delete;
+        chunk& operator=(const chunk&) = delete;
+        chunk& operator=(chunk&&) = delete;
+
+        ~chunk()
+        {
+            for (size_t i = 0; elements && i < count; i++)
+            {
+                elements[i].~T();
+            }
+        }
+
+        page_buffer memory;
+        T* elements;
+        size_t count;
+    };
+
+    std::vector<chunk> m_chunks;
+    size_t m_chunk_elements = N; //Elements in every chunk, set when the first is chained
     size_t m_ptr = 0;
 };
 
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+/// <summary>
+/// Size assumed for a cache line, used to keep values written by different threads apart
+/// </summary>
+const size_t CACHE_LINE_SIZE = 64;
+
+/// <summary>
+/// Span kept between values written by different threads. Two cache lines, as x86 prefetches adjacent lines in pairs,
+/// so values on neighbouring lines can still contend
+/// </summary>
+const size_t FALSE_SHARING_SIZE = 2 * CACHE_LINE_SIZE;
+
+/// <summary>
+/// A value padded on both sides, so it shares no cache line with its neighbours wherever it's placed - for a hot shared
+/// value inside an ordinary heap allocation, where alignment can't be relied on
+/// </summary>
+/// <typeparam name="T"></typeparam>
+template<typename T>
+struct padded_value
+{
+    uint8_t _pad_before[FALSE_SHARING_SIZE];
+    T value{};
+    uint8_t _pad_after[FALSE_SHARING_SIZE];
+};
+
+/// <summary>
+/// Allocates memory aligned to alignment, which must be a power of two no smaller than sizeof(void*)
+/// Cpp 14 new ignores alignments beyond the default, so over aligned types are allocated through this
+/// </summary>
+/// <param name="bytes"></param>
+/// <param name="alignment"></param>
+/// <returns></returns>
+inline void* aligned_allocate(size_t bytes, size_t alignment)
+{
+#ifdef _WIN32
+    void* memory = _aligned_malloc(bytes, alignment);
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, alignment, bytes) != 0)
+    {
+        memory = nullptr;
+    }
+#endif
+    if (!memory)
+    {
+        printf("Error! could not allocate %llu bytes aligned to %llu\n", (unsigned long long)bytes, (unsigned long long)alignment);
+        fflush(stdout);
+        std::abort();
+    }
+    return memory;
+}
+
+inline void aligned_free(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+template<typename T>
+struct aligned_delete
+{
+    inline void operator()(T* value) const
+    {
+        value->~T();
+        aligned_free(value);
+    }
+};
+
+template<typename T>
+using aligned_ptr = std::unique_ptr<T, aligned_delete<T>>;
+
+/// <summary>
+/// Makes a T at its full alignment, on the calling thread, so its pages are first touched, and so placed, on that thread's node
+/// </summary>
+/// <typeparam name="T"></typeparam>
+/// <typeparam name="...Args"></typeparam>
+/// <param name="...args"></param>
+/// <returns></returns>
+template<typename T, typename... Args>
+inline aligned_ptr<T> make_aligned(Args&&... args)
+{
+    void* memory = aligned_allocate(sizeof(T), alignof(T));
+    return aligned_ptr<T>(new (memory) T(std::forward<Args>(args)...));
+}
+
+/// <summary>
+/// A counting latch - work items are added to it as they are handed out, counted down as they complete,
+/// and wait() blocks until the count returns to zero
+/// The count is atomic, so finishing an item only takes the lock when it may be the last one, to wake the waiters
+/// </summary>
+class completion_latch
+{
+public:
+
+    /// <summary>
+    /// Adds count outstanding items to the latch
+    /// </summary>
+    /// <param name="count"></param>
+    inline void add(size_t count)
+    {
+        m_count.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    /// <summary>
+    /// Marks one outstanding item as completed, waking waiters if none remain
+    /// </summary>
+    inline void count_down()
+    {
+        size_t count = m_count.load(std::memory_order_relaxed);
+        while (count > 1)
+        {
+            if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+
+        //The last item reaches zero under the lock, so a waiter can't see zero, return and destroy the latch
+        //before the notify is done
+        std::lock_guard<std::mutex> lock{ m_mutex };
+        if (m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_done.notify_all();
+        }
+    }
+
+    /// <summary>
+    /// Blocks until every item added to the latch has been counted down
+    /// </summary>
+    inline void wait()
+    {
+        std::unique_lock<std::mutex> lock{ m_mutex };
+        m_done.wait(lock, [this]() { return m_count.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    std::atomic<size_t> m_count{ 0 };
+};
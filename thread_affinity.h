@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//////////////////////////////////////////////////
+// Pinning workers to cpus, and finding which NUMA node they're on
+//////////////////////////////////////////////////
+
+/// <summary>
+/// How workers are placed on cpus
+/// </summary>
+enum class affinity_policy
+{
+    None, //Left to the OS, which may migrate them
+    Compact, //Fill one NUMA node before moving to the next, keeping workers close together
+    Scatter, //Deal workers round robin across NUMA nodes, spreading memory bandwidth
+    List //Worker i on the i'th cpu of an explicit list
+};
+
+/// <summary>
+/// A cpu the process may run on, and the NUMA node it belongs to
+/// </summary>
+struct cpu_info
+{
+    int cpu;
+    int node;
+};
+
+/// <summary>
+/// Parses a cpu list in the kernel's format, e.g. "0-3,8,10-11"
+/// </summary>
+/// <param name="text"></param>
+/// <param name="out_cpus"></param>
+/// <returns></returns>
+inline bool parse_cpu_list(const std::string& text, std::vector<int>& out_cpus)
+{
+    out_cpus.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        int first, last;
+        char trailing;
+        if (sscanf(item.c_str(), "%d-%d%c", &first, &last, &trailing) == 2)
+        {
+        }
+        else if (sscanf(item.c_str(), "%d%c", &first, &trailing) == 1)
+        {
+            last = first;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (first < 0 || last < first)
+        {
+            return false;
+        }
+
+        for (int cpu = first; cpu <= last; cpu++)
+        {
+            out_cpus.push_back(cpu);
+        }
+    }
+    return !out_cpus.empty();
+}
+
+/// <summary>
+/// Parses an affinity option: "none", "compact", "scatter", or an explicit cpu list
+/// </summary>
+/// <param name="text"></param>
+/// <param name="out_policy"></param>
+/// <param name="out_cpus">the list, for affinity_policy::List</param>
+/// <returns></returns>
+inline bool parse_affinity(const std::string& text, affinity_policy& out_policy, std::vector<int>& out_cpus)
+{
+    out_cpus.clear();
+    if (text == "none")
+    {
+        out_policy = affinity_policy::None;
+    }
+    else if (text == "compact")
+    {
+        out_policy = affinity_policy::Compact;
+    }
+    else if (text == "scatter")
+    {
+        out_policy = affinity_policy::Scatter;
+    }
+    else if (parse_cpu_list(text, out_cpus))
+    {
+        out_policy = affinity_policy::List;
+    }
+    else
+    {
+        printf("Error! affinity must be none, compact, scatter or a cpu list like 0-3,8, got '%s'\n", text.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// <summary>
+/// The cpus this process may run on, ordered by node then cpu number
+/// Nodes come from sysfs on linux, everywhere else all cpus are treated as one node
+/// </summary>
+/// <returns></returns>
+inline std::vector<cpu_info> get_cpu_topology()
+{
+    std::vector<cpu_info> cpus;
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    for (int node = 0; ; node++)
+    {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string line;
+        if (!in || !std::getline(in, line))
+        {
+            break;
+        }
+
+        std::vector<int> node_cpus;
+        if (!parse_cpu_list(line, node_cpus))
+        {
+            continue; //memory only node
+        }
+
+        for (int cpu : node_cpus)
+        {
+            if (!have_allowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+            {
+                cpus.push_back({ cpu, node });
+            }
+        }
+    }
+
+    if (cpus.empty() && have_allowed)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus.push_back({ cpu, 0 });
+            }
+        }
+    }
+#endif
+
+    if (cpus.empty())
+    {
+        int count = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < count; cpu++)
+        {
+            cpus.push_back({ cpu, 0 });
+        }
+    }
+
+    return cpus;
+}
+
+/// <summary>
+/// Picks a cpu for each of num_workers workers, wrapping around if there are more workers than cpus
+/// </summary>
+/// <param name="policy"></param>
+/// <param name="list">cpus to use with affinity_policy::List</param>
+/// <param name="topology"></param>
+/// <param name="num_workers"></param>
+/// <returns>the cpu and node of each worker, cpu -1 to leave a worker unpinned</returns>
+inline std::vector<cpu_info> plan_worker_cpus(affinity_policy policy, const std::vector<int>& list, const std::vector<cpu_info>& topology, size_t num_workers)
+{
+    std::vector<cpu_info> placement(num_workers, cpu_info{ -1, -1 });
+    std::vector<cpu_info> order;
+
+    switch (policy)
+    {
+    case affinity_policy::None:
+        return placement;
+    case affinity_policy::Compact:
+        order = topology;
+        break;
+    case affinity_policy::Scatter:
+        {
+            //Take the first unused cpu of each node in turn
+            int num_nodes = 0;
+            for (const cpu_info& info : topology)
+            {
+                num_nodes = std::max(num_nodes, info.node + 1);
+            }
+
+            std::vector<std::vector<cpu_info>> by_node(num_nodes);
+            for (const cpu_info& info : topology)
+            {
+                by_node[info.node].push_back(info);
+            }
+
+            for (size_t i = 0; order.size() < topology.size(); i++)
+            {
+                for (const std::vector<cpu_info>& node_cpus : by_node)
+                {
+                    if (i < node_cpus.size())
+                    {
+                        order.push_back(node_cpus[i]);
+                    }
+                }
+            }
+        }
+        break;
+    case affinity_policy::List:
+        for (int cpu : list)
+        {
+            auto found = std::find_if(topology.begin(), topology.end(), [&](const cpu_info& info) { return info.cpu == cpu; });
+            order.push_back({ cpu, found != topology.end() ? found->node : -1 });
+        }
+        break;
+    }
+
+    for (size_t i = 0; i < num_workers && !order.empty(); i++)
+    {
+        placement[i] = order[i % order.size()];
+    }
+    return placement;
+}
+
+/// <summary>
+/// Pins the calling thread to a single cpu, returns false if that isn't possible here
+/// </summary>
+/// <param name="cpu"></param>
+/// <returns></returns>
+inline bool pin_current_thread(int cpu)
+{
+    if (cpu < 0)
+    {
+        return false;
+    }
+
+#ifdef _WIN32
+    if (cpu >= 64)
+    {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
@@ -1,13 +1,19 @@
 #pragma once
 
-#include <list>
+#include <condition_variable>
+#include <cstdint>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 ///As the writer of this code, helps me logically manage unlabelled scopes, ie for when mutexes should be unlocked
-#define scope if(false){} else 
+#define scope if(false){} else
 
 /// <summary>
 /// A thread safe-queue that allows enqueing and dequeing from multiple producer / consumer threads
+/// Elements live in intrusive nodes, which are kept on a free list once dequeued rather than freed, so once the queue
+/// has grown to its working size, enqueueing and dequeueing never touch the heap. Elements only need to be movable
 /// </summary>
 /// <typeparam name="T"></typeparam>
 /// <returns></returns>
@@ -24,31 +30,159 @@ public:
     {
     }
 
+    thread_safe_queue(const thread_safe_queue&) = delete;
+    thread_safe_queue& operator=(const thread_safe_queue&) = delete;
+
+    ~thread_safe_queue()
+    {
+        while (m_head)
+        {
+            node* next = m_head->next;
+            m_head->value().~T();
+            delete m_head;
+            m_head = next;
+        }
+
+        while (m_free)
+        {
+            node* next = m_free->next;
+            delete m_free;
+            m_free = next;
+        }
+    }
+
+    /// <summary>
+    /// Changes the bound on the queue size, a negative bound means unbounded
+    /// </summary>
+    /// <param name="bound"></param>
+    inline void set_bound(int64_t bound)
+    {
+        scope
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+            m_size_bound = bound;
+        }
+        m_not_full.notify_all();
+    }
+
     /// <summary>
-    /// blocks if size >= bound
+    /// blocks if size >= bound, until a consumer makes room
     /// </summary>
     /// <param name="element"></param>
     inline void enqueue(T element)
     {
-        std::list<T> node;
-        node.push_back(std::move(element));
+        scope
+        {
+            std::unique_lock<std::mutex> lock{ m_mutex };
+
+            node* n = acquire_node(lock);
 
-        while (true)
+            m_not_full.wait(lock, [this]() { return !is_full(); });
+
+            push_back(n, std::move(element));
+        }
+
+        m_not_empty.notify_one();
+    }
+
+    /// <summary>
+    /// Enqueues unless size >= bound, in which case returns false rather than waiting for room
+    /// </summary>
+    /// <param name="element"></param>
+    /// <returns></returns>
+    inline bool try_enqueue(T element)
+    {
+        scope
         {
-            scope 
+            std::unique_lock<std::mutex> lock{ m_mutex };
+
+            if (is_full())
+            {
+                return false;
+            }
+
+            node* n = acquire_node(lock);
+
+            //Growing the free list unlocks, so there may no longer be room
+            if (is_full())
             {
-                std::lock_guard<std::mutex> lock{ m_mutex };
+                release_node(n);
+                return false;
+            }
+
+            push_back(n, std::move(element));
+        }
+
+        m_not_empty.notify_one();
+        return true;
+    }
 
-                //Using 'splice' to avoid memory allocations in critical section
-                if (m_size_bound < 0 || m_queue.size() < (size_t) m_size_bound)
+    /// <summary>
+    /// Enqueues every element of [first, last), moving them out, under one lock rather than one per element
+    /// Blocks while size >= bound, waking consumers for the elements already enqueued before it waits
+    /// </summary>
+    /// <typeparam name="Iterator"></typeparam>
+    /// <param name="first"></param>
+    /// <param name="last"></param>
+    template<typename Iterator>
+    inline void enqueue_bulk(Iterator first, Iterator last)
+    {
+        scope
+        {
+            std::unique_lock<std::mutex> lock{ m_mutex };
+
+            while (first != last)
+            {
+                node* n = acquire_node(lock);
+
+                if (is_full())
                 {
-                    m_queue.splice(m_queue.end(), node);
-                    return;
+                    m_not_empty.notify_all();
+                    m_not_full.wait(lock, [this]() { return !is_full(); });
                 }
+
+                push_back(n, std::move(*first));
+                ++first;
             }
+        }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        m_not_empty.notify_all();
+    }
+
+    /// <summary>
+    /// Dequeues up to max elements under one lock, writing them to out. Doesn't wait for elements, returns how many were dequeued
+    /// </summary>
+    /// <typeparam name="OutputIterator"></typeparam>
+    /// <param name="out"></param>
+    /// <param name="max"></param>
+    /// <returns></returns>
+    template<typename OutputIterator>
+    inline size_t try_dequeue_bulk(OutputIterator out, size_t max)
+    {
+        size_t count = 0;
+
+        scope
+        {
+            std::lock_guard<std::mutex> lock{ m_mutex };
+
+            while (count < max && m_size > 0)
+            {
+                *out = pop_front();
+                ++out;
+                count++;
+            }
+        }
+
+        if (count == 1)
+        {
+            m_not_full.notify_one();
         }
+        else if (count > 1)
+        {
+            m_not_full.notify_all();
+        }
+
+        return count;
     }
 
     /// <summary>
@@ -58,11 +192,15 @@ public:
     /// <returns></returns>
     inline T blocking_dequeue()
     {
-        T element;
-        while (!dequeue(element))
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+        std::unique_lock<std::mutex> lock{ m_mutex };
+
+        m_not_empty.wait(lock, [this]() { return m_size > 0; });
+
+        T element = pop_front();
+
+        lock.unlock();
+        m_not_full.notify_one();
+
         return element;
     }
 
@@ -73,23 +211,19 @@ public:
     /// <returns></returns>
     inline bool dequeue(T& outElement)
     {
-        std::list<T> temp;
-        
         scope
         {
             std::lock_guard<std::mutex> lock{ m_mutex };
 
-            if (m_queue.size() < 1)
+            if (m_size < 1)
             {
                 return false;
             }
 
-            temp.splice(temp.end(), m_queue, m_queue.begin());
+            outElement = pop_front();
         }
 
-        outElement = std::move(temp.front());
-
-        temp.pop_front();
+        m_not_full.notify_one();
 
         return true;
     }
@@ -101,11 +235,93 @@ public:
     inline size_t size() const
     {
         std::lock_guard<std::mutex> lock{ m_mutex };
-        return m_queue.size();
+        return m_size;
     }
 
 private:
-    std::list<T> m_queue;
-    std::mutex m_mutex;
+
+    struct node
+    {
+        node* next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage; //Holds an element only while the node is queued
+
+        inline T& value()
+        {
+            return *reinterpret_cast<T*>(&storage);
+        }
+    };
+
+    inline bool is_full() const
+    {
+        return m_size_bound >= 0 && m_size >= (size_t)m_size_bound;
+    }
+
+    /// <summary>
+    /// Takes a node from the free list. If it's empty, a new node is allocated with the lock released,
+    /// so the heap is never touched inside the critical section
+    /// </summary>
+    /// <param name="lock"></param>
+    /// <returns></returns>
+    inline node* acquire_node(std::unique_lock<std::mutex>& lock)
+    {
+        if (m_free)
+        {
+            node* n = m_free;
+            m_free = n->next;
+            return n;
+        }
+
+        lock.unlock();
+        node* n = new node();
+        lock.lock();
+        return n;
+    }
+
+    inline void release_node(node* n)
+    {
+        n->next = m_free;
+        m_free = n;
+    }
+
+    inline void push_back(node* n, T&& element)
+    {
+        new (&n->storage) T(std::move(element));
+        n->next = nullptr;
+
+        if (m_tail)
+        {
+            m_tail->next = n;
+        }
+        else
+        {
+            m_head = n;
+        }
+        m_tail = n;
+        m_size++;
+    }
+
+    inline T pop_front()
+    {
+        node* n = m_head;
+        m_head = n->next;
+        if (!m_head)
+        {
+            m_tail = nullptr;
+        }
+        m_size--;
+
+        T element = std::move(n->value());
+        n->value().~T();
+        release_node(n);
+        return element;
+    }
+
+    node* m_head = nullptr;
+    node* m_tail = nullptr;
+    node* m_free = nullptr; //Nodes dequeued, kept for reuse
+    size_t m_size = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_not_full; //Signalled when an element is removed, for producers blocked on the bound
+    std::condition_variable m_not_empty; //Signalled when an element is added, for blocked consumers
     int64_t m_size_bound;
-};
\ No newline at end of file
+};